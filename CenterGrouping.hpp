@@ -0,0 +1,203 @@
+/* ============================================================================================== */
+/* CenterGrouping.hpp                                                                             */
+/*                                                                                                */
+/* This file is part of ObjectDetector (github.com/joostvanstuijvenberg/ObjectDetector.git)       */
+/*                                                                                                */
+/* Joost van Stuijvenberg                                                                         */
+/* ============================================================================================== */
+
+#ifndef OBJECTDETECTOR_CENTERGROUPING_HPP
+#define OBJECTDETECTOR_CENTERGROUPING_HPP
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <unordered_map>
+#include <vector>
+
+#include "opencv2/opencv.hpp"
+
+#include "Filter.hpp"
+
+/* ---------------------------------------------------------------------------------------------- */
+/* Center grouping                                                                                */
+/*                                                                                                */
+/* Combines the centers found at the successive threshold levels into groups that represent the   */
+/* same object. A center joins the first (oldest) group whose median center is closer than the    */
+/* minimum distance between objects, or closer than the radius of either of the two centers.      */
+/* Groups are kept sorted by radius; centers that join no group start a new group once the level  */
+/* has been processed completely.                                                                 */
+/*                                                                                                */
+/* To avoid comparing every center with every group, the groups are kept in a uniform grid with   */
+/* cells the size of the minimum distance between objects, hashed by the cell of their median     */
+/* center. Groups with a median radius larger than that distance are also registered in all cells */
+/* their radius covers, or in a separate list when that would be too many cells.                  */
+/*                                                                                                */
+/* The vectors of the groups are kept when the grouping is cleared, and reused for the groups of  */
+/* the next image, so that they do not need to be allocated again. Clearing still takes time      */
+/* linear in the number of groups and occupied cells; it just frees nothing.                      */
+/* ---------------------------------------------------------------------------------------------- */
+class CenterGrouping {
+public:
+    inline explicit CenterGrouping(double minDistBetweenObjects = 10.0)
+            : _minDist(minDistBetweenObjects), _cellSize(std::max(minDistBetweenObjects, 1.0)) {}
+    inline double minDistBetweenObjects() const { return _minDist; }
+    inline void minDistBetweenObjects(double minDistBetweenObjects) {
+        _minDist = minDistBetweenObjects;
+        _cellSize = std::max(minDistBetweenObjects, 1.0);
+        clear();
+    }
+    inline void clear();
+    inline void addLevel(const std::vector<Center> &centers);
+    inline const std::vector<std::vector<Center>> &groups() const { return _groups; }
+private:
+    typedef std::unordered_map<uint64_t, std::vector<size_t>> Grid;
+    static const int MAX_REACH_CELLS = 64;
+    double _minDist, _cellSize;
+    std::vector<std::vector<Center>> _groups;
+    std::vector<std::vector<Center>> _newGroups;
+    std::vector<std::vector<Center>> _spareGroups;
+    Grid _locations;
+    Grid _reaches;
+    std::vector<size_t> _wide;
+    std::vector<size_t> _candidates;
+    inline int cell(double v) const { return (int)std::floor(v / _cellSize); }
+    inline static uint64_t key(int cx, int cy) { return ((uint64_t)(uint32_t)cx << 32) | (uint32_t)cy; }
+    inline void update(size_t group, const Center &median, bool insert);
+    inline void collect(const Center &center);
+    inline std::vector<Center> spareGroup();
+};
+
+void CenterGrouping::clear()
+{
+    for (auto &group : _groups) {
+        group.clear();
+        _spareGroups.push_back(std::move(group));
+    }
+    _groups.clear();
+    _locations.clear();
+    _reaches.clear();
+    _wide.clear();
+}
+
+/* ---------------------------------------------------------------------------------------------- */
+void CenterGrouping::addLevel(const std::vector<Center> &centers)
+{
+    auto &newGroups = _newGroups;
+    newGroups.clear();
+    for (auto &curCenter : centers) {
+        // Of all candidate groups, take the oldest one the center belongs to.
+        collect(curCenter);
+        auto found = std::numeric_limits<size_t>::max();
+        for (auto g : _candidates) {
+            if (g >= found)
+                continue;
+            auto &median = _groups[g][_groups[g].size() / 2];
+            double dist = norm(median.location - curCenter.location);
+            bool isNew = dist >= _minDist && dist >= median.radius && dist >= curCenter.radius;
+            if (!isNew)
+                found = g;
+        }
+
+        if (found == std::numeric_limits<size_t>::max()) {
+            newGroups.push_back(spareGroup());
+            newGroups.back().push_back(curCenter);
+            continue;
+        }
+
+        // Adding a center may change the median of the group; if so, re-index it.
+        auto &group = _groups[found];
+        auto median = group[group.size() / 2];
+        group.insert(std::upper_bound(group.begin(), group.end(), curCenter,
+                                      [](const Center &a, const Center &b) { return a.radius < b.radius; }),
+                     curCenter);
+        auto &newMedian = group[group.size() / 2];
+        if (newMedian.location != median.location || newMedian.radius != median.radius) {
+            update(found, median, false);
+            update(found, newMedian, true);
+        }
+    }
+
+    for (auto &newGroup : newGroups) {
+        _groups.emplace_back(std::move(newGroup));
+        update(_groups.size() - 1, _groups.back()[0], true);
+    }
+}
+
+/* ---------------------------------------------------------------------------------------------- */
+/* An empty vector for a new group; one that was used before, when available.                     */
+/* ---------------------------------------------------------------------------------------------- */
+std::vector<Center> CenterGrouping::spareGroup()
+{
+    if (_spareGroups.empty())
+        return std::vector<Center>();
+    auto group = std::move(_spareGroups.back());
+    _spareGroups.pop_back();
+    return group;
+}
+
+/* ---------------------------------------------------------------------------------------------- */
+/* Adds the group to, or removes it from the grid, based on the given median center.              */
+/* ---------------------------------------------------------------------------------------------- */
+void CenterGrouping::update(size_t group, const Center &median, bool insert)
+{
+    auto edit = [&](std::vector<size_t> &list) {
+        if (insert)
+            list.push_back(group);
+        else
+            list.erase(std::find(list.begin(), list.end(), group));
+    };
+    auto editCell = [&](Grid &grid, uint64_t k) {
+        auto &list = grid[k];
+        edit(list);
+        if (list.empty())
+            grid.erase(k);
+    };
+
+    editCell(_locations, key(cell(median.location.x), cell(median.location.y)));
+
+    if (median.radius <= _minDist)
+        return;
+    int x0 = cell(median.location.x - median.radius), x1 = cell(median.location.x + median.radius);
+    int y0 = cell(median.location.y - median.radius), y1 = cell(median.location.y + median.radius);
+    if ((int64_t)(x1 - x0 + 1) * (y1 - y0 + 1) > MAX_REACH_CELLS) {
+        edit(_wide);
+        return;
+    }
+    for (int cy = y0; cy <= y1; cy++)
+        for (int cx = x0; cx <= x1; cx++)
+            editCell(_reaches, key(cx, cy));
+}
+
+/* ---------------------------------------------------------------------------------------------- */
+/* Collects the groups that might contain the center: those with a median center within the       */
+/* larger of the minimum distance and the center's radius, and those whose radius might reach it. */
+/* ---------------------------------------------------------------------------------------------- */
+void CenterGrouping::collect(const Center &center)
+{
+    _candidates.clear();
+    _candidates.insert(_candidates.end(), _wide.begin(), _wide.end());
+
+    auto reach = _reaches.find(key(cell(center.location.x), cell(center.location.y)));
+    if (reach != _reaches.end())
+        _candidates.insert(_candidates.end(), reach->second.begin(), reach->second.end());
+
+    double range = std::max(_minDist, center.radius);
+    int x0 = cell(center.location.x - range), x1 = cell(center.location.x + range);
+    int y0 = cell(center.location.y - range), y1 = cell(center.location.y + range);
+    if ((int64_t)(x1 - x0 + 1) * (y1 - y0 + 1) > (int64_t)_locations.size()) {
+        // Visiting the cells would be more work than visiting all groups.
+        for (auto &location : _locations)
+            _candidates.insert(_candidates.end(), location.second.begin(), location.second.end());
+        return;
+    }
+    for (int cy = y0; cy <= y1; cy++)
+        for (int cx = x0; cx <= x1; cx++) {
+            auto location = _locations.find(key(cx, cy));
+            if (location != _locations.end())
+                _candidates.insert(_candidates.end(), location->second.begin(), location->second.end());
+        }
+}
+
+#endif //OBJECTDETECTOR_CENTERGROUPING_HPP
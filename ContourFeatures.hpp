@@ -0,0 +1,293 @@
+/* ============================================================================================== */
+/* ContourFeatures.hpp                                                                            */
+/*                                                                                                */
+/* This file is part of ObjectDetector (github.com/joostvanstuijvenberg/ObjectDetector.git)       */
+/*                                                                                                */
+/* Joost van Stuijvenberg                                                                         */
+/* ============================================================================================== */
+
+#ifndef OBJECTDETECTOR_CONTOURFEATURES_HPP
+#define OBJECTDETECTOR_CONTOURFEATURES_HPP
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#include "opencv2/opencv.hpp"
+
+/* ---------------------------------------------------------------------------------------------- */
+/* Derived features of a contour                                                                  */
+/* ---------------------------------------------------------------------------------------------- */
+enum ContourFeature {
+    FEATURE_PERIMETER,
+    FEATURE_HULL,
+    FEATURE_HULL_AREA,
+    FEATURE_BOUNDING_RECT,
+    FEATURE_CENTROID,
+    FEATURE_INERTIA_RATIO,
+    FEATURE_BINARY_BOUNDING_RECT,
+    FEATURE_COUNT
+};
+
+/* ---------------------------------------------------------------------------------------------- */
+/* Feature counters: how often each feature was asked for, and how often it had to be computed.   */
+/* The difference is the number of computations that were saved by sharing the features.          */
+/* ---------------------------------------------------------------------------------------------- */
+struct ContourFeatureCounters
+{
+    size_t requested[FEATURE_COUNT] = {};
+    size_t computed[FEATURE_COUNT] = {};
+    inline size_t saved(ContourFeature feature) const { return requested[feature] - computed[feature]; }
+    inline void clear() { *this = ContourFeatureCounters(); }
+    inline ContourFeatureCounters &operator+=(const ContourFeatureCounters &other) {
+        for (int f = 0; f < FEATURE_COUNT; f++) {
+            requested[f] += other.requested[f];
+            computed[f] += other.computed[f];
+        }
+        return *this;
+    }
+};
+
+/* ---------------------------------------------------------------------------------------------- */
+/* Features that belong to a binary image as a whole, shared by all of its contours.              */
+/* ---------------------------------------------------------------------------------------------- */
+struct LevelFeatures
+{
+    bool hasBoundingRect = false;
+    cv::Rect boundingRect;
+};
+
+/* ---------------------------------------------------------------------------------------------- */
+/* Contour features                                                                               */
+/*                                                                                                */
+/* Gives the filters access to a contour and everything derived from it. Derived features are     */
+/* computed when they are first asked for and remembered after that, so filters that need the     */
+/* same feature do not compute it again. An object is used for one contour on one thread.         */
+/* ---------------------------------------------------------------------------------------------- */
+class ContourFeatures {
+public:
+    inline ContourFeatures(const cv::Mat &grayImage, const cv::Mat &binaryImage, const std::vector<cv::Point> &contour,
+                           const cv::Moments &moments, LevelFeatures *level = nullptr,
+                           ContourFeatureCounters *counters = nullptr)
+            : _grayImage(grayImage), _binaryImage(binaryImage), _contour(contour), _moments(moments),
+              _level(level), _counters(counters) {}
+    inline const cv::Mat &grayImage() const { return _grayImage; }
+    inline const cv::Mat &binaryImage() const { return _binaryImage; }
+    inline const std::vector<cv::Point> &contour() const { return _contour; }
+    inline const cv::Moments &moments() const { return _moments; }
+    inline double area() const { return _moments.m00; }
+    inline double perimeter() const;
+    inline const std::vector<cv::Point> &hull() const;
+    inline double hullArea() const;
+    inline cv::Rect boundingRect() const;
+    inline cv::Point2d centroid() const;
+    inline double inertiaRatio() const;
+    inline cv::Rect binaryBoundingRect() const;
+private:
+    const cv::Mat &_grayImage;
+    const cv::Mat &_binaryImage;
+    const std::vector<cv::Point> &_contour;
+    const cv::Moments &_moments;
+    LevelFeatures *_level;
+    ContourFeatureCounters *_counters;
+    mutable unsigned int _known = 0;
+    mutable double _perimeter = 0, _hullArea = 0, _inertiaRatio = 0;
+    mutable std::vector<cv::Point> _hull;
+    mutable cv::Rect _boundingRect;
+    mutable cv::Point2d _centroid;
+    // Counts the request and returns true when the feature still needs to be computed.
+    inline bool compute(ContourFeature feature) const;
+};
+
+bool ContourFeatures::compute(ContourFeature feature) const
+{
+    if (_counters != nullptr)
+        _counters->requested[feature]++;
+    if (_known & (1u << feature))
+        return false;
+    _known |= 1u << feature;
+    if (_counters != nullptr)
+        _counters->computed[feature]++;
+    return true;
+}
+
+/* ---------------------------------------------------------------------------------------------- */
+double ContourFeatures::perimeter() const
+{
+    if (compute(FEATURE_PERIMETER))
+        _perimeter = cv::arcLength(_contour, true);
+    return _perimeter;
+}
+
+/* ---------------------------------------------------------------------------------------------- */
+const std::vector<cv::Point> &ContourFeatures::hull() const
+{
+    if (compute(FEATURE_HULL))
+        cv::convexHull(_contour, _hull);
+    return _hull;
+}
+
+/* ---------------------------------------------------------------------------------------------- */
+double ContourFeatures::hullArea() const
+{
+    if (compute(FEATURE_HULL_AREA))
+        _hullArea = cv::contourArea(hull());
+    return _hullArea;
+}
+
+/* ---------------------------------------------------------------------------------------------- */
+cv::Rect ContourFeatures::boundingRect() const
+{
+    if (compute(FEATURE_BOUNDING_RECT))
+        _boundingRect = cv::boundingRect(_contour);
+    return _boundingRect;
+}
+
+/* ---------------------------------------------------------------------------------------------- */
+cv::Point2d ContourFeatures::centroid() const
+{
+    if (compute(FEATURE_CENTROID))
+        _centroid = cv::Point2d(_moments.m10 / _moments.m00, _moments.m01 / _moments.m00);
+    return _centroid;
+}
+
+/* ---------------------------------------------------------------------------------------------- */
+/* Ratio between the smallest and largest moment of inertia; 1 for a circle, 0 for a line.        */
+/* ---------------------------------------------------------------------------------------------- */
+double ContourFeatures::inertiaRatio() const
+{
+    if (!compute(FEATURE_INERTIA_RATIO))
+        return _inertiaRatio;
+
+    const auto &moments = _moments;
+    double denominator = std::sqrt(std::pow(2 * moments.mu11, 2) + std::pow(moments.mu20 - moments.mu02, 2));
+    const double eps = 1e-2;
+    if (denominator > eps) {
+        double cosmin = (moments.mu20 - moments.mu02) / denominator;
+        double sinmin = 2 * moments.mu11 / denominator;
+        double cosmax = -cosmin;
+        double sinmax = -sinmin;
+
+        double imin =
+                0.5 * (moments.mu20 + moments.mu02) - 0.5 * (moments.mu20 - moments.mu02) * cosmin -
+                moments.mu11 * sinmin;
+        double imax =
+                0.5 * (moments.mu20 + moments.mu02) - 0.5 * (moments.mu20 - moments.mu02) * cosmax -
+                moments.mu11 * sinmax;
+        _inertiaRatio = imin / imax;
+    } else
+        _inertiaRatio = 1;
+    return _inertiaRatio;
+}
+
+/* ---------------------------------------------------------------------------------------------- */
+/* Bounding rectangle of all foreground pixels in the binary image. It is computed once for all   */
+/* contours of the same binary image.                                                             */
+/* ---------------------------------------------------------------------------------------------- */
+cv::Rect ContourFeatures::binaryBoundingRect() const
+{
+    if (_counters != nullptr)
+        _counters->requested[FEATURE_BINARY_BOUNDING_RECT]++;
+    if (_level != nullptr && _level->hasBoundingRect)
+        return _level->boundingRect;
+    if (_counters != nullptr)
+        _counters->computed[FEATURE_BINARY_BOUNDING_RECT]++;
+    auto rect = cv::boundingRect(_binaryImage);
+    if (_level != nullptr) {
+        _level->hasBoundingRect = true;
+        _level->boundingRect = rect;
+    }
+    return rect;
+}
+
+/* ---------------------------------------------------------------------------------------------- */
+/* Contour batch                                                                                  */
+/*                                                                                                */
+/* The contours of a level with their basic features in a structure of arrays, so that filters    */
+/* can evaluate all of them at once. alive[i] is cleared when contour i is filtered out, and      */
+/* confidence[i] holds the confidence filters assign to it. Perimeters are computed when first    */
+/* asked for, for the contours that are still alive. Features that filters compute for the batch  */
+/* are counted in counters, when given, like those of single contours.                            */
+/* ---------------------------------------------------------------------------------------------- */
+struct ContourBatch
+{
+    std::vector<const std::vector<cv::Point> *> contours;
+    std::vector<cv::Moments> moments;
+    std::vector<double> area, mu20, mu02, mu11;
+    std::vector<double> confidence;
+    std::vector<uchar> alive;
+    // Scratch space for the filters.
+    std::vector<double> values;
+    ContourFeatureCounters *counters = nullptr;
+
+    inline size_t size() const { return contours.size(); }
+    inline size_t count() const { return (size_t)std::count(alive.begin(), alive.end(), 1); }
+    inline void clear();
+    inline void add(const std::vector<cv::Point> &contour, const cv::Moments &m);
+    inline const std::vector<double> &perimeters();
+    inline void countComputed(ContourFeature feature);
+private:
+    std::vector<double> _perimeter;
+    std::vector<uchar> _hasPerimeter;
+};
+
+void ContourBatch::clear()
+{
+    contours.clear();
+    moments.clear();
+    area.clear();
+    mu20.clear();
+    mu02.clear();
+    mu11.clear();
+    confidence.clear();
+    alive.clear();
+    _perimeter.clear();
+    _hasPerimeter.clear();
+}
+
+/* ---------------------------------------------------------------------------------------------- */
+void ContourBatch::add(const std::vector<cv::Point> &contour, const cv::Moments &m)
+{
+    contours.push_back(&contour);
+    moments.push_back(m);
+    area.push_back(m.m00);
+    mu20.push_back(m.mu20);
+    mu02.push_back(m.mu02);
+    mu11.push_back(m.mu11);
+    confidence.push_back(1);
+    alive.push_back(m.m00 != 0.0 ? 1 : 0);
+}
+
+/* ---------------------------------------------------------------------------------------------- */
+const std::vector<double> &ContourBatch::perimeters()
+{
+    _perimeter.resize(size(), 0);
+    _hasPerimeter.resize(size(), 0);
+    for (size_t i = 0; i < size(); i++) {
+        if (!alive[i])
+            continue;
+        if (counters != nullptr)
+            counters->requested[FEATURE_PERIMETER]++;
+        if (_hasPerimeter[i])
+            continue;
+        if (counters != nullptr)
+            counters->computed[FEATURE_PERIMETER]++;
+        _perimeter[i] = cv::arcLength(*contours[i], true);
+        _hasPerimeter[i] = 1;
+    }
+    return _perimeter;
+}
+
+/* ---------------------------------------------------------------------------------------------- */
+/* Counts a feature that was asked for and computed for each contour that is still alive.         */
+/* ---------------------------------------------------------------------------------------------- */
+void ContourBatch::countComputed(ContourFeature feature)
+{
+    if (counters == nullptr)
+        return;
+    size_t n = count();
+    counters->requested[feature] += n;
+    counters->computed[feature] += n;
+}
+
+#endif //OBJECTDETECTOR_CONTOURFEATURES_HPP
@@ -0,0 +1,341 @@
+/* ============================================================================================== */
+/* DetectionPipeline.hpp                                                                          */
+/*                                                                                                */
+/* This file is part of ObjectDetector (github.com/joostvanstuijvenberg/ObjectDetector.git)       */
+/*                                                                                                */
+/* Joost van Stuijvenberg                                                                         */
+/* ============================================================================================== */
+
+#ifndef OBJECTDETECTOR_DETECTIONPIPELINE_HPP
+#define OBJECTDETECTOR_DETECTIONPIPELINE_HPP
+
+#include <atomic>
+#include <chrono>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include "opencv2/opencv.hpp"
+
+#include "Instrumentation.hpp"
+#include "ObjectDetector.hpp"
+
+/* ---------------------------------------------------------------------------------------------- */
+/* Bounded queue                                                                                  */
+/*                                                                                                */
+/* A lock-free queue of fixed capacity for any number of producers and consumers (D. Vyukov's     */
+/* bounded MPMC queue). Each cell carries a sequence number that tells whether it is ready to be  */
+/* written or read in the current round, so producers and consumers only contend on their own     */
+/* position counter. The capacity is rounded up to a power of two.                                */
+/*                                                                                                */
+/* push() and pop() wait while the queue is full or empty, which is what applies back-pressure to */
+/* the stage before a slow one. Once the queue is closed, pop() returns false when it is empty.   */
+/* ---------------------------------------------------------------------------------------------- */
+template<typename T>
+class BoundedQueue {
+public:
+    inline explicit BoundedQueue(size_t capacity);
+    inline size_t capacity() const { return _mask + 1; }
+    inline bool tryPush(T &value);
+    inline bool tryPop(T &value);
+    inline bool push(T &value, const std::atomic<bool> &stop);
+    inline bool pop(T &value, const std::atomic<bool> &stop);
+    inline void close() { _closed = true; }
+private:
+    struct Cell
+    {
+        std::atomic<size_t> sequence;
+        T value;
+    };
+    std::unique_ptr<Cell[]> _cells;
+    size_t _mask;
+    // The counters are written by different threads; keep them on cache lines of their own.
+    alignas(64) std::atomic<size_t> _enqueue;
+    alignas(64) std::atomic<size_t> _dequeue;
+    alignas(64) std::atomic<bool> _closed;
+    // Yields the first few times, then sleeps, so that waiting threads leave the cores to others.
+    inline static void wait(int &attempt);
+};
+
+template<typename T>
+BoundedQueue<T>::BoundedQueue(size_t capacity) : _enqueue(0), _dequeue(0), _closed(false)
+{
+    size_t size = 2;
+    while (size < capacity)
+        size *= 2;
+    _cells.reset(new Cell[size]);
+    _mask = size - 1;
+    for (size_t i = 0; i < size; i++)
+        _cells[i].sequence.store(i, std::memory_order_relaxed);
+}
+
+/* ---------------------------------------------------------------------------------------------- */
+/* Moves value into the queue and returns true, or returns false when the queue is full.          */
+/* ---------------------------------------------------------------------------------------------- */
+template<typename T>
+bool BoundedQueue<T>::tryPush(T &value)
+{
+    size_t position = _enqueue.load(std::memory_order_relaxed);
+    for (;;) {
+        auto &cell = _cells[position & _mask];
+        size_t sequence = cell.sequence.load(std::memory_order_acquire);
+        auto difference = (std::ptrdiff_t)sequence - (std::ptrdiff_t)position;
+        if (difference == 0) {
+            if (_enqueue.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) {
+                cell.value = std::move(value);
+                cell.sequence.store(position + 1, std::memory_order_release);
+                return true;
+            }
+        } else if (difference < 0)
+            return false;
+        else
+            position = _enqueue.load(std::memory_order_relaxed);
+    }
+}
+
+/* ---------------------------------------------------------------------------------------------- */
+/* Moves the oldest value out of the queue and returns true, or returns false when it is empty.   */
+/* ---------------------------------------------------------------------------------------------- */
+template<typename T>
+bool BoundedQueue<T>::tryPop(T &value)
+{
+    size_t position = _dequeue.load(std::memory_order_relaxed);
+    for (;;) {
+        auto &cell = _cells[position & _mask];
+        size_t sequence = cell.sequence.load(std::memory_order_acquire);
+        auto difference = (std::ptrdiff_t)sequence - (std::ptrdiff_t)(position + 1);
+        if (difference == 0) {
+            if (_dequeue.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) {
+                value = std::move(cell.value);
+                cell.sequence.store(position + _mask + 1, std::memory_order_release);
+                return true;
+            }
+        } else if (difference < 0)
+            return false;
+        else
+            position = _dequeue.load(std::memory_order_relaxed);
+    }
+}
+
+/* ---------------------------------------------------------------------------------------------- */
+/* Waits for room in the queue and moves value into it. Returns false when stop was set first.    */
+/* ---------------------------------------------------------------------------------------------- */
+template<typename T>
+bool BoundedQueue<T>::push(T &value, const std::atomic<bool> &stop)
+{
+    for (int attempt = 0; !tryPush(value); wait(attempt))
+        if (stop)
+            return false;
+    return true;
+}
+
+/* ---------------------------------------------------------------------------------------------- */
+/* Waits for a value and moves it out of the queue. Returns false when the queue is closed and    */
+/* empty, or when stop was set.                                                                   */
+/* ---------------------------------------------------------------------------------------------- */
+template<typename T>
+bool BoundedQueue<T>::pop(T &value, const std::atomic<bool> &stop)
+{
+    for (int attempt = 0; !tryPop(value); wait(attempt)) {
+        if (stop)
+            return false;
+        // Everything was pushed before the queue was closed, so one more try settles it.
+        if (_closed)
+            return tryPop(value);
+    }
+    return true;
+}
+
+/* ---------------------------------------------------------------------------------------------- */
+template<typename T>
+void BoundedQueue<T>::wait(int &attempt)
+{
+    if (attempt++ < 64)
+        std::this_thread::yield();
+    else
+        std::this_thread::sleep_for(std::chrono::microseconds(100));
+}
+
+/* ---------------------------------------------------------------------------------------------- */
+/* Statistics of one stage of a detection pipeline. Busy is the time the workers of the stage     */
+/* spent on items, waiting the time they spent waiting for input or for room in the next queue.   */
+/* The utilisation is the busy time as a fraction of the time all its workers were available: a   */
+/* stage close to 1 is the bottleneck, the others wait for it.                                    */
+/* ---------------------------------------------------------------------------------------------- */
+struct PipelineStageStatistics
+{
+    unsigned int workers = 0;
+    size_t items = 0;
+    double busySeconds = 0;
+    double waitSeconds = 0;
+    double utilisation = 0;
+    inline PipelineStageStatistics &operator+=(const PipelineStageStatistics &other) {
+        items += other.items;
+        busySeconds += other.busySeconds;
+        waitSeconds += other.waitSeconds;
+        return *this;
+    }
+};
+
+/* ---------------------------------------------------------------------------------------------- */
+/* Statistics of a run of a detection pipeline: its stages, the time it took and the number of    */
+/* images that could not be decoded.                                                              */
+/* ---------------------------------------------------------------------------------------------- */
+struct PipelineStatistics
+{
+    PipelineStageStatistics decode, detect, sink;
+    double seconds = 0;
+    size_t failed = 0;
+};
+
+/* ---------------------------------------------------------------------------------------------- */
+/* Detection pipeline                                                                             */
+/*                                                                                                */
+/* Runs an object detector over a numbered sequence of images in three stages, each with its own  */
+/* worker threads: decode (e.g. cv::imread()), detect, and sink (e.g. writing the keypoints). The */
+/* stages are connected by bounded queues, so decoding and writing overlap with detection rather  */
+/* than holding it up, while no more decoded images are kept than the queues can hold. Each       */
+/* detect worker has a detection context of its own.                                              */
+/*                                                                                                */
+/* The decoder returns false when an image could not be decoded; the image is then skipped. The   */
+/* sink receives the keypoints of each image with its index, in the order in which the images are */
+/* done rather than by index. With more than one sink worker, the sink is called concurrently.    */
+/* An exception thrown by any stage stops the pipeline, and is rethrown by run().                 */
+/* ---------------------------------------------------------------------------------------------- */
+class DetectionPipeline {
+public:
+    typedef std::function<bool(size_t index, cv::Mat &image)> Decoder;
+    typedef std::function<void(size_t index, const std::vector<cv::KeyPoint> &keypoints)> Sink;
+    inline explicit DetectionPipeline(std::shared_ptr<const ObjectDetector> detector)
+            : _detector(std::move(detector)), _decodeWorkers(1), _detectWorkers(1), _sinkWorkers(1),
+              _queueCapacity(16) {
+        assert(_detector != nullptr);
+    }
+    inline unsigned int decodeWorkers() const { return _decodeWorkers; }
+    inline void decodeWorkers(unsigned int decodeWorkers) { _decodeWorkers = decodeWorkers; }
+    inline unsigned int detectWorkers() const { return _detectWorkers; }
+    inline void detectWorkers(unsigned int detectWorkers) { _detectWorkers = detectWorkers; }
+    inline unsigned int sinkWorkers() const { return _sinkWorkers; }
+    inline void sinkWorkers(unsigned int sinkWorkers) { _sinkWorkers = sinkWorkers; }
+    inline size_t queueCapacity() const { return _queueCapacity; }
+    inline void queueCapacity(size_t queueCapacity) { _queueCapacity = queueCapacity; }
+    inline const PipelineStatistics &statistics() const { return _statistics; }
+    inline void run(size_t count, const Decoder &decode, const Sink &sink);
+private:
+    struct Decoded
+    {
+        size_t index;
+        cv::Mat image;
+    };
+    struct Detected
+    {
+        size_t index;
+        std::vector<cv::KeyPoint> keypoints;
+    };
+    std::shared_ptr<const ObjectDetector> _detector;
+    unsigned int _decodeWorkers;
+    unsigned int _detectWorkers;
+    unsigned int _sinkWorkers;
+    size_t _queueCapacity;
+    PipelineStatistics _statistics;
+};
+
+/* ---------------------------------------------------------------------------------------------- */
+/* Processes images 0 up to count. Returns when all of them have been through the sink.           */
+/* ---------------------------------------------------------------------------------------------- */
+void DetectionPipeline::run(size_t count, const Decoder &decode, const Sink &sink)
+{
+    assert(_decodeWorkers > 0 && _detectWorkers > 0 && _sinkWorkers > 0);
+
+    BoundedQueue<Decoded> decoded(_queueCapacity);
+    BoundedQueue<Detected> detected(_queueCapacity);
+    std::atomic<size_t> next(0), failed(0);
+    std::atomic<bool> stop(false);
+    auto origin = TraceClock::now();
+
+    // Every worker has its own statistics, and the last worker of a stage to finish closes the
+    // queue to the next stage.
+    unsigned int workers = _decodeWorkers + _detectWorkers + _sinkWorkers;
+    std::vector<PipelineStageStatistics> statistics(workers);
+    std::vector<std::exception_ptr> errors(workers);
+    std::atomic<unsigned int> decoding(_decodeWorkers), detecting(_detectWorkers);
+    auto worker = [&](unsigned int w, const std::function<void(PipelineStageStatistics &)> &process) {
+        try {
+            process(statistics[w]);
+        } catch (...) {
+            errors[w] = std::current_exception();
+            stop = true;
+        }
+    };
+
+    std::vector<std::thread> threads;
+    for (unsigned int w = 0; w < _decodeWorkers; w++)
+        threads.emplace_back(worker, w, [&](PipelineStageStatistics &s) {
+            for (size_t i = next++; i < count && !stop; i = next++) {
+                Decoded item{i, cv::Mat()};
+                double start = traceTime(origin);
+                bool ok = decode(i, item.image);
+                double end = traceTime(origin);
+                s.busySeconds += end - start;
+                if (!ok) {
+                    failed++;
+                    continue;
+                }
+                s.items++;
+                decoded.push(item, stop);
+                s.waitSeconds += traceTime(origin) - end;
+            }
+            if (--decoding == 0)
+                decoded.close();
+        });
+    for (unsigned int w = 0; w < _detectWorkers; w++)
+        threads.emplace_back(worker, _decodeWorkers + w, [&](PipelineStageStatistics &s) {
+            DetectionContext context;
+            Decoded item;
+            for (double start = traceTime(origin); decoded.pop(item, stop); start = traceTime(origin)) {
+                double begin = traceTime(origin);
+                Detected result{item.index, _detector->detect(item.image, context)};
+                item.image.release();
+                double end = traceTime(origin);
+                s.busySeconds += end - begin;
+                s.items++;
+                detected.push(result, stop);
+                s.waitSeconds += (begin - start) + (traceTime(origin) - end);
+            }
+            if (--detecting == 0)
+                detected.close();
+        });
+    for (unsigned int w = 0; w < _sinkWorkers; w++)
+        threads.emplace_back(worker, _decodeWorkers + _detectWorkers + w, [&](PipelineStageStatistics &s) {
+            Detected item;
+            for (double start = traceTime(origin); detected.pop(item, stop); start = traceTime(origin)) {
+                double begin = traceTime(origin);
+                sink(item.index, item.keypoints);
+                s.busySeconds += traceTime(origin) - begin;
+                s.waitSeconds += begin - start;
+                s.items++;
+            }
+        });
+    for (auto &thread : threads)
+        thread.join();
+
+    _statistics = PipelineStatistics();
+    _statistics.seconds = traceTime(origin);
+    _statistics.failed = failed;
+    for (unsigned int w = 0; w < workers; w++) {
+        auto &stage = w < _decodeWorkers ? _statistics.decode
+                                         : w < _decodeWorkers + _detectWorkers ? _statistics.detect : _statistics.sink;
+        stage += statistics[w];
+        stage.workers++;
+    }
+    for (auto stage : {&_statistics.decode, &_statistics.detect, &_statistics.sink})
+        if (_statistics.seconds > 0)
+            stage->utilisation = stage->busySeconds / (stage->workers * _statistics.seconds);
+    for (auto &error : errors)
+        if (error)
+            std::rethrow_exception(error);
+}
+
+#endif //OBJECTDETECTOR_DETECTIONPIPELINE_HPP
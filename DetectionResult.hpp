@@ -0,0 +1,146 @@
+/* ============================================================================================== */
+/* DetectionResult.hpp                                                                            */
+/*                                                                                                */
+/* This file is part of ObjectDetector (github.com/joostvanstuijvenberg/ObjectDetector.git)       */
+/*                                                                                                */
+/* Joost van Stuijvenberg                                                                         */
+/* ============================================================================================== */
+
+#ifndef OBJECTDETECTOR_DETECTIONRESULT_HPP
+#define OBJECTDETECTOR_DETECTIONRESULT_HPP
+
+#include <cstdint>
+#include <vector>
+
+#include "opencv2/opencv.hpp"
+
+/* ---------------------------------------------------------------------------------------------- */
+/* The attributes of the objects a detection result can hold, besides their location and size.    */
+/* Area, bounds, circularity, inertia ratio and contour are those of the object at the threshold  */
+/* level that determined its size (the level with the median radius); confidence is the mean      */
+/* confidence over all levels, and repeatability the number of levels the object was found in.    */
+/* ---------------------------------------------------------------------------------------------- */
+enum ObjectAttribute {
+    ATTRIBUTE_AREA = 1 << 0,
+    ATTRIBUTE_BOUNDS = 1 << 1,
+    ATTRIBUTE_CIRCULARITY = 1 << 2,
+    ATTRIBUTE_INERTIA = 1 << 3,
+    ATTRIBUTE_CONFIDENCE = 1 << 4,
+    ATTRIBUTE_REPEATABILITY = 1 << 5,
+    ATTRIBUTE_CONTOUR = 1 << 6,
+    ATTRIBUTE_ALL = (1 << 7) - 1
+};
+
+// The attributes of an object at a single level, as opposed to those of all its levels together.
+const int LEVEL_ATTRIBUTES = ATTRIBUTE_AREA | ATTRIBUTE_BOUNDS | ATTRIBUTE_CIRCULARITY | ATTRIBUTE_INERTIA |
+                             ATTRIBUTE_CONTOUR;
+// The attributes that need the contour of an object, rather than just its pixels.
+const int CONTOUR_ATTRIBUTES = ATTRIBUTE_CIRCULARITY | ATTRIBUTE_INERTIA | ATTRIBUTE_CONTOUR;
+
+/* ---------------------------------------------------------------------------------------------- */
+/* Detection result                                                                               */
+/*                                                                                                */
+/* The objects found by ObjectDetector::detect() in a structure of arrays: element i of each      */
+/* array belongs to object i. The location (x, y) and size (the diameter) are always filled, in   */
+/* the same order and with the same values as the keypoints detect() returns otherwise; the other */
+/* arrays only for the attributes that were asked for, and are empty otherwise. The contour       */
+/* points of all objects are kept in a single array, those of object i from contourStart[i] up to */
+/* contourStart[i + 1].                                                                           */
+/*                                                                                                */
+/* The attributes are the ones the filters computed already, or are computed from the contour     */
+/* and its moments; the image is not looked at again. The arrays keep their memory when the       */
+/* result is filled again, so a result can be reused from frame to frame.                         */
+/* ---------------------------------------------------------------------------------------------- */
+struct DetectionResult
+{
+    inline explicit DetectionResult(int attributes = 0) : attributes(attributes) {}
+    int attributes;
+    std::vector<float> x, y, size;
+    std::vector<double> area;
+    std::vector<cv::Rect> bounds;
+    std::vector<float> circularity, inertia, confidence;
+    std::vector<int> repeatability;
+    std::vector<cv::Point> contourPoints;
+    std::vector<uint32_t> contourStart = std::vector<uint32_t>(1, 0);
+
+    inline size_t count() const { return x.size(); }
+    inline bool has(ObjectAttribute attribute) const { return (attributes & attribute) != 0; }
+    inline cv::KeyPoint keypoint(size_t i) const { return cv::KeyPoint(cv::Point2f(x[i], y[i]), size[i]); }
+    inline const cv::Point *contourBegin(size_t i) const { return contourPoints.data() + contourStart[i]; }
+    inline const cv::Point *contourEnd(size_t i) const { return contourPoints.data() + contourStart[i + 1]; }
+    inline void clear();
+    inline void add(const DetectionResult &other, size_t i);
+    inline void addAttributes(const DetectionResult &other, size_t i);
+    inline void translate(size_t first, const cv::Point &offset);
+};
+
+/* ---------------------------------------------------------------------------------------------- */
+/* Removes all objects, but keeps the memory of the arrays.                                       */
+/* ---------------------------------------------------------------------------------------------- */
+void DetectionResult::clear()
+{
+    x.clear();
+    y.clear();
+    size.clear();
+    area.clear();
+    bounds.clear();
+    circularity.clear();
+    inertia.clear();
+    confidence.clear();
+    repeatability.clear();
+    contourPoints.clear();
+    contourStart.assign(1, 0);
+}
+
+/* ---------------------------------------------------------------------------------------------- */
+/* Appends object i of another result that has the same attributes.                               */
+/* ---------------------------------------------------------------------------------------------- */
+void DetectionResult::add(const DetectionResult &other, size_t i)
+{
+    x.push_back(other.x[i]);
+    y.push_back(other.y[i]);
+    size.push_back(other.size[i]);
+    if (has(ATTRIBUTE_CONFIDENCE))
+        confidence.push_back(other.confidence[i]);
+    if (has(ATTRIBUTE_REPEATABILITY))
+        repeatability.push_back(other.repeatability[i]);
+    addAttributes(other, i);
+}
+
+/* ---------------------------------------------------------------------------------------------- */
+/* Appends the single level attributes of object i of another result that has them all.           */
+/* ---------------------------------------------------------------------------------------------- */
+void DetectionResult::addAttributes(const DetectionResult &other, size_t i)
+{
+    if (has(ATTRIBUTE_AREA))
+        area.push_back(other.area[i]);
+    if (has(ATTRIBUTE_BOUNDS))
+        bounds.push_back(other.bounds[i]);
+    if (has(ATTRIBUTE_CIRCULARITY))
+        circularity.push_back(other.circularity[i]);
+    if (has(ATTRIBUTE_INERTIA))
+        inertia.push_back(other.inertia[i]);
+    if (has(ATTRIBUTE_CONTOUR)) {
+        contourPoints.insert(contourPoints.end(), other.contourBegin(i), other.contourEnd(i));
+        contourStart.push_back((uint32_t)contourPoints.size());
+    }
+}
+
+/* ---------------------------------------------------------------------------------------------- */
+/* Moves the objects from index first onwards by offset, e.g. from a region of interest to the    */
+/* image it is part of.                                                                           */
+/* ---------------------------------------------------------------------------------------------- */
+void DetectionResult::translate(size_t first, const cv::Point &offset)
+{
+    for (size_t i = first; i < x.size(); i++) {
+        x[i] += (float)offset.x;
+        y[i] += (float)offset.y;
+    }
+    for (size_t i = first; i < bounds.size(); i++)
+        bounds[i] += offset;
+    if (has(ATTRIBUTE_CONTOUR))
+        for (size_t p = contourStart[first]; p < contourPoints.size(); p++)
+            contourPoints[p] += offset;
+}
+
+#endif //OBJECTDETECTOR_DETECTIONRESULT_HPP
@@ -13,6 +13,8 @@
 
 #include "opencv2/opencv.hpp"
 
+#include "ContourFeatures.hpp"
+#include "FilterKernels.hpp"
 #include "Persistence.hpp"
 
 /* ---------------------------------------------------------------------------------------------- */
@@ -23,14 +25,50 @@ struct Center
     cv::Point2d location;
     double radius;
     double confidence;
+    // Where the attributes of the object were recorded, when they were asked for: the level and the
+    // index of the object in that level (see DetectionResult).
+    int level = -1;
+    int object = -1;
+};
+
+/* ---------------------------------------------------------------------------------------------- */
+/* Filter statistics: how often a filter was evaluated, how often it filtered out a contour and   */
+/* how much time it took. The time is only measured when the detector orders filters adaptively.  */
+/* ---------------------------------------------------------------------------------------------- */
+struct FilterStatistics
+{
+    size_t evaluations = 0;
+    size_t rejections = 0;
+    double seconds = 0;
+    inline double rejectionRate() const { return evaluations == 0 ? 0 : (double)rejections / evaluations; }
+    inline double secondsPerEvaluation() const { return evaluations == 0 ? 0 : seconds / evaluations; }
+    inline FilterStatistics &operator+=(const FilterStatistics &other) {
+        evaluations += other.evaluations;
+        rejections += other.rejections;
+        seconds += other.seconds;
+        return *this;
+    }
 };
 
 /* ---------------------------------------------------------------------------------------------- */
 /* Abstract filter                                                                                */
+/*                                                                                                */
+/* filter() must not change the filter itself, since the object detector may call it from         */
+/* several threads at once. Anything it computes for a contour can be stored in the Center.       */
+/* Features derived from the contour should be taken from the ContourFeatures, so that filters    */
+/* that need the same feature share a single computation.                                         */
 /* ---------------------------------------------------------------------------------------------- */
 class Filter {
 public:
-    virtual bool filter(const cv::Mat& grayImage, const cv::Mat& binaryImage, const std::vector<cv::Point> &contour, Center &center, const cv::Moments &moments) = 0;
+    virtual bool filter(const ContourFeatures &features, Center &center) const = 0;
+    // Filters all contours of a batch at once, by clearing batch.alive for the contours that are
+    // filtered out. Returns false when the filter does not support batches; filter() is then used
+    // for each contour instead.
+    virtual bool filterBatch(ContourBatch &batch) const { return false; }
+    // Returns false when filter() only uses the area, the centroid and the grayscale image, so that
+    // the object detector may find the objects by labeling connected components instead of tracing
+    // their contours.
+    virtual bool needsContour() const { return true; }
     virtual void read(const cv::FileNode &node) = 0;
     virtual void write(cv::FileStorage &storage) const = 0;
 };
@@ -43,8 +81,13 @@ public:
     inline explicit AreaFilter(double min = 0, double max = 0) : _min(min), _max(max) {
         assert (_min <= _max);
     }
-    inline bool filter(const cv::Mat& grayImage, const cv::Mat& binaryImage, const std::vector<cv::Point> &contour, Center &center, const cv::Moments &moments) override {
-        return moments.m00 < _min || moments.m00 > _max;
+    inline bool filter(const ContourFeatures &features, Center &center) const override {
+        return features.area() < _min || features.area() > _max;
+    }
+    inline bool needsContour() const override { return false; }
+    inline bool filterBatch(ContourBatch &batch) const override {
+        rejectOutside(batch.area.data(), batch.alive.data(), batch.size(), _min, _max);
+        return true;
     }
     inline double minArea() const { return _min; }
     inline void minArea(double min) { _min = min; }
@@ -72,12 +115,18 @@ public:
     inline explicit CircularityFilter(double min = 0, double max = 0) : _min(min), _max(max) {
         assert (_min <= _max);
     }
-    inline bool filter(const cv::Mat& grayImage, const cv::Mat& binaryImage, const std::vector<cv::Point> &contour, Center &center, const cv::Moments &moments) override {
-        double area = moments.m00;
-        double perimeter = arcLength(cv::Mat(contour), true);
+    inline bool filter(const ContourFeatures &features, Center &center) const override {
+        double area = features.area();
+        double perimeter = features.perimeter();
         double ratio = 4 * CV_PI * area / (perimeter * perimeter);
         return ratio < _min || ratio > _max;
     }
+    inline bool filterBatch(ContourBatch &batch) const override {
+        batch.values.resize(batch.size());
+        circularities(batch.area.data(), batch.perimeters().data(), batch.values.data(), batch.size());
+        rejectOutside(batch.values.data(), batch.alive.data(), batch.size(), _min, _max);
+        return true;
+    }
     inline double minCircularity() const { return _min; }
     inline void minCircularity(double min) { _min = min; }
     inline double maxCircularity() const { return _max; }
@@ -104,13 +153,11 @@ public:
     inline explicit ConvexityFilter(double min = 0, double max = 0) : _min(min), _max(max) {
         assert (_min <= _max);
     }
-    inline bool filter(const cv::Mat& grayImage, const cv::Mat& binaryImage, const std::vector<cv::Point> &contour, Center &center, const cv::Moments &moments) override {
+    inline bool filter(const ContourFeatures &features, Center &center) const override {
         // If filtering by convexity is requested, skip this contour if the ratio between the contour
         // area and the hull area is not within the specified limits.
-        std::vector<cv::Point> hull;
-        convexHull(cv::Mat(contour), hull);
-        double area = moments.m00;
-        double hullArea = contourArea(cv::Mat(hull));
+        double area = features.area();
+        double hullArea = features.hullArea();
         double ratio = area / hullArea;
         return ratio < _min || ratio > _max;
     }
@@ -140,28 +187,20 @@ public:
     inline explicit InertiaFilter(double min = 0, double max = 0) : _min(min), _max(max) {
         assert (_min <= _max);
     }
-    inline bool filter(const cv::Mat& grayImage, const cv::Mat& binaryImage, const std::vector<cv::Point> &contour, Center &center, const cv::Moments &moments) override {
-        double denominator = std::sqrt(std::pow(2 * moments.mu11, 2) + std::pow(moments.mu20 - moments.mu02, 2));
-        const double eps = 1e-2;
-        double ratio;
-        if (denominator > eps) {
-            double cosmin = (moments.mu20 - moments.mu02) / denominator;
-            double sinmin = 2 * moments.mu11 / denominator;
-            double cosmax = -cosmin;
-            double sinmax = -sinmin;
-
-            double imin =
-                    0.5 * (moments.mu20 + moments.mu02) - 0.5 * (moments.mu20 - moments.mu02) * cosmin -
-                    moments.mu11 * sinmin;
-            double imax =
-                    0.5 * (moments.mu20 + moments.mu02) - 0.5 * (moments.mu20 - moments.mu02) * cosmax -
-                    moments.mu11 * sinmax;
-            ratio = imin / imax;
-        } else
-            ratio = 1;
+    inline bool filter(const ContourFeatures &features, Center &center) const override {
+        double ratio = features.inertiaRatio();
         center.confidence = ratio * ratio;
         return ratio < _min || ratio > _max;
     }
+    inline bool filterBatch(ContourBatch &batch) const override {
+        batch.values.resize(batch.size());
+        batch.countComputed(FEATURE_INERTIA_RATIO);
+        inertiaRatios(batch.mu20.data(), batch.mu02.data(), batch.mu11.data(), batch.values.data(), batch.size());
+        for (size_t i = 0; i < batch.size(); i++)
+            batch.confidence[i] = batch.values[i] * batch.values[i];
+        rejectOutside(batch.values.data(), batch.alive.data(), batch.size(), _min, _max);
+        return true;
+    }
     inline double minInertia() const { return _min; }
     inline void minInertia(double min) { _min = min; }
     inline double maxInertia() const { return _max; }
@@ -188,14 +227,15 @@ public:
     inline explicit ColorFilter(uchar min = 0, uchar max = 0) : _min(min), _max(max) {
         assert (_min <= _max);
     }
-    inline bool filter(const cv::Mat& grayImage, const cv::Mat& binaryImage, const std::vector<cv::Point> &contour, Center &center, const cv::Moments &moments) override {
+    inline bool filter(const ContourFeatures &features, Center &center) const override {
         // Prevent division by zero, should this contour have no area.
-        if (moments.m00 == 0.0)
+        if (features.area() == 0.0)
             return true;
-        center.location = cv::Point2d(moments.m10 / moments.m00, moments.m01 / moments.m00);
-        auto location = cv::Point2d(moments.m10 / moments.m00, moments.m01 / moments.m00);
-        return grayImage.at<uchar>(cvRound(location.y), cvRound(location.x)) < _min || grayImage.at<uchar>(cvRound(location.y), cvRound(location.x)) > _max;
+        center.location = features.centroid();
+        auto color = features.grayImage().at<uchar>(cvRound(center.location.y), cvRound(center.location.x));
+        return color < _min || color > _max;
     }
+    inline bool needsContour() const override { return false; }
     inline uchar minColor() const { return _min; }
     inline void minColor(uchar min) { _min = min; }
     inline uchar maxColor() const { return _max; }
@@ -222,10 +262,11 @@ public:
     inline explicit ExtentFilter(double min = 0, double max = 0) : _min(min), _max(max) {
         assert (_min <= _max);
     }
-    inline bool filter(const cv::Mat& grayImage, const cv::Mat& binaryImage, const std::vector<cv::Point> &contour, Center &center, const cv::Moments &moments) override {
-        auto contourArea = moments.m00;
-        auto boundingRect = cv::boundingRect(binaryImage);
-        auto extent = moments.m00 / boundingRect.area();
+    inline bool filter(const ContourFeatures &features, Center &center) const override {
+        // Threshold algorithms that report regions themselves provide no binary image; use the
+        // contour's own bounding rectangle then.
+        auto boundingRect = features.binaryImage().empty() ? features.boundingRect() : features.binaryBoundingRect();
+        auto extent = features.area() / boundingRect.area();
         return extent < _min || extent > _max;
     }
     inline double minExtent() const { return _min; }
@@ -0,0 +1,204 @@
+/* ============================================================================================== */
+/* FilterKernels.hpp                                                                              */
+/*                                                                                                */
+/* This file is part of ObjectDetector (github.com/joostvanstuijvenberg/ObjectDetector.git)       */
+/*                                                                                                */
+/* Joost van Stuijvenberg                                                                         */
+/* ============================================================================================== */
+
+#ifndef OBJECTDETECTOR_FILTERKERNELS_HPP
+#define OBJECTDETECTOR_FILTERKERNELS_HPP
+
+#include <cmath>
+#include <cstddef>
+
+#if defined(__AVX__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include "opencv2/opencv.hpp"
+
+/* ---------------------------------------------------------------------------------------------- */
+/* Kernels for evaluating filters on a batch of contours at once, and for locating objects. They  */
+/* use AVX or SSE2 when the compiler targets it (e.g. with -march=native) and plain loops         */
+/* otherwise. The results are the same as those of the filters' filter() functions for a single  */
+/* contour, as long as the compiler does not contract multiplications and additions into FMA      */
+/* instructions (-ffp-contract=off).                                                              */
+/* ---------------------------------------------------------------------------------------------- */
+
+/* ---------------------------------------------------------------------------------------------- */
+/* Clears alive[i] when values[i] < min or values[i] > max.                                       */
+/* ---------------------------------------------------------------------------------------------- */
+inline void rejectOutside(const double *values, uchar *alive, size_t n, double min, double max)
+{
+    size_t i = 0;
+#if defined(__AVX__)
+    auto vmin = _mm256_set1_pd(min), vmax = _mm256_set1_pd(max);
+    for (; i + 4 <= n; i += 4) {
+        auto v = _mm256_loadu_pd(values + i);
+        int outside = _mm256_movemask_pd(_mm256_or_pd(_mm256_cmp_pd(v, vmin, _CMP_LT_OQ),
+                                                      _mm256_cmp_pd(v, vmax, _CMP_GT_OQ)));
+        for (int j = 0; outside != 0; j++, outside >>= 1)
+            if (outside & 1)
+                alive[i + j] = 0;
+    }
+#elif defined(__SSE2__)
+    auto vmin = _mm_set1_pd(min), vmax = _mm_set1_pd(max);
+    for (; i + 2 <= n; i += 2) {
+        auto v = _mm_loadu_pd(values + i);
+        int outside = _mm_movemask_pd(_mm_or_pd(_mm_cmplt_pd(v, vmin), _mm_cmpgt_pd(v, vmax)));
+        if (outside & 1)
+            alive[i] = 0;
+        if (outside & 2)
+            alive[i + 1] = 0;
+    }
+#endif
+    for (; i < n; i++)
+        if (values[i] < min || values[i] > max)
+            alive[i] = 0;
+}
+
+/* ---------------------------------------------------------------------------------------------- */
+/* circularity[i] = 4 * pi * area[i] / perimeter[i]^2                                             */
+/* ---------------------------------------------------------------------------------------------- */
+inline void circularities(const double *area, const double *perimeter, double *circularity, size_t n)
+{
+    size_t i = 0;
+#if defined(__AVX__)
+    auto fourPi = _mm256_set1_pd(4 * CV_PI);
+    for (; i + 4 <= n; i += 4) {
+        auto p = _mm256_loadu_pd(perimeter + i);
+        _mm256_storeu_pd(circularity + i, _mm256_div_pd(_mm256_mul_pd(fourPi, _mm256_loadu_pd(area + i)),
+                                                        _mm256_mul_pd(p, p)));
+    }
+#elif defined(__SSE2__)
+    auto fourPi = _mm_set1_pd(4 * CV_PI);
+    for (; i + 2 <= n; i += 2) {
+        auto p = _mm_loadu_pd(perimeter + i);
+        _mm_storeu_pd(circularity + i, _mm_div_pd(_mm_mul_pd(fourPi, _mm_loadu_pd(area + i)), _mm_mul_pd(p, p)));
+    }
+#endif
+    for (; i < n; i++)
+        circularity[i] = 4 * CV_PI * area[i] / (perimeter[i] * perimeter[i]);
+}
+
+/* ---------------------------------------------------------------------------------------------- */
+/* Ratio between the smallest and largest moment of inertia, from the central moments; the same   */
+/* computation as ContourFeatures::inertiaRatio().                                                */
+/* ---------------------------------------------------------------------------------------------- */
+inline void inertiaRatios(const double *mu20, const double *mu02, const double *mu11, double *ratio, size_t n)
+{
+    const double eps = 1e-2;
+    size_t i = 0;
+#if defined(__AVX__)
+    auto half = _mm256_set1_pd(0.5), two = _mm256_set1_pd(2), one = _mm256_set1_pd(1), veps = _mm256_set1_pd(eps);
+    for (; i + 4 <= n; i += 4) {
+        auto a = _mm256_loadu_pd(mu20 + i), b = _mm256_loadu_pd(mu02 + i), c = _mm256_loadu_pd(mu11 + i);
+        auto diff = _mm256_sub_pd(a, b), twoC = _mm256_mul_pd(two, c);
+        auto denominator = _mm256_sqrt_pd(_mm256_add_pd(_mm256_mul_pd(twoC, twoC), _mm256_mul_pd(diff, diff)));
+        auto cosmin = _mm256_div_pd(diff, denominator), sinmin = _mm256_div_pd(twoC, denominator);
+        auto mean = _mm256_mul_pd(half, _mm256_add_pd(a, b)), halfDiff = _mm256_mul_pd(half, diff);
+        auto imin = _mm256_sub_pd(_mm256_sub_pd(mean, _mm256_mul_pd(halfDiff, cosmin)), _mm256_mul_pd(c, sinmin));
+        auto imax = _mm256_sub_pd(_mm256_add_pd(mean, _mm256_mul_pd(halfDiff, cosmin)),
+                                  _mm256_mul_pd(c, _mm256_sub_pd(_mm256_setzero_pd(), sinmin)));
+        auto valid = _mm256_cmp_pd(denominator, veps, _CMP_GT_OQ);
+        _mm256_storeu_pd(ratio + i, _mm256_blendv_pd(one, _mm256_div_pd(imin, imax), valid));
+    }
+#elif defined(__SSE2__)
+    auto half = _mm_set1_pd(0.5), two = _mm_set1_pd(2), one = _mm_set1_pd(1), veps = _mm_set1_pd(eps);
+    for (; i + 2 <= n; i += 2) {
+        auto a = _mm_loadu_pd(mu20 + i), b = _mm_loadu_pd(mu02 + i), c = _mm_loadu_pd(mu11 + i);
+        auto diff = _mm_sub_pd(a, b), twoC = _mm_mul_pd(two, c);
+        auto denominator = _mm_sqrt_pd(_mm_add_pd(_mm_mul_pd(twoC, twoC), _mm_mul_pd(diff, diff)));
+        auto cosmin = _mm_div_pd(diff, denominator), sinmin = _mm_div_pd(twoC, denominator);
+        auto mean = _mm_mul_pd(half, _mm_add_pd(a, b)), halfDiff = _mm_mul_pd(half, diff);
+        auto imin = _mm_sub_pd(_mm_sub_pd(mean, _mm_mul_pd(halfDiff, cosmin)), _mm_mul_pd(c, sinmin));
+        auto imax = _mm_sub_pd(_mm_add_pd(mean, _mm_mul_pd(halfDiff, cosmin)),
+                               _mm_mul_pd(c, _mm_sub_pd(_mm_setzero_pd(), sinmin)));
+        auto valid = _mm_cmpgt_pd(denominator, veps);
+        _mm_storeu_pd(ratio + i, _mm_or_pd(_mm_and_pd(valid, _mm_div_pd(imin, imax)), _mm_andnot_pd(valid, one)));
+    }
+#endif
+    for (; i < n; i++) {
+        double denominator = std::sqrt(std::pow(2 * mu11[i], 2) + std::pow(mu20[i] - mu02[i], 2));
+        if (denominator > eps) {
+            double cosmin = (mu20[i] - mu02[i]) / denominator;
+            double sinmin = 2 * mu11[i] / denominator;
+            double imin = 0.5 * (mu20[i] + mu02[i]) - 0.5 * (mu20[i] - mu02[i]) * cosmin - mu11[i] * sinmin;
+            double imax = 0.5 * (mu20[i] + mu02[i]) - 0.5 * (mu20[i] - mu02[i]) * -cosmin - mu11[i] * -sinmin;
+            ratio[i] = imin / imax;
+        } else
+            ratio[i] = 1;
+    }
+}
+
+/* ---------------------------------------------------------------------------------------------- */
+/* dist[i] = distance from center to points[i], in no particular order (the distances are only    */
+/* needed for a median). The same computation as cv::norm(center - cv::Point2d(points[i])).       */
+/* ---------------------------------------------------------------------------------------------- */
+inline void distances(const cv::Point *points, size_t n, const cv::Point2d &center, double *dist)
+{
+    auto xy = reinterpret_cast<const int *>(points);
+    size_t i = 0;
+#if defined(__AVX__)
+    auto c = _mm256_setr_pd(center.x, center.y, center.x, center.y);
+    for (; i + 4 <= n; i += 4) {
+        // Two points per vector as x, y, x, y; adding the pairs yields points i, i + 2, i + 1, i + 3.
+        auto a = _mm256_sub_pd(c, _mm256_cvtepi32_pd(_mm_loadu_si128((const __m128i *)(xy + 2 * i))));
+        auto b = _mm256_sub_pd(c, _mm256_cvtepi32_pd(_mm_loadu_si128((const __m128i *)(xy + 2 * i + 4))));
+        auto squares = _mm256_hadd_pd(_mm256_mul_pd(a, a), _mm256_mul_pd(b, b));
+        _mm256_storeu_pd(dist + i, _mm256_sqrt_pd(squares));
+    }
+#elif defined(__SSE2__)
+    auto c = _mm_setr_pd(center.x, center.y);
+    for (; i + 2 <= n; i += 2) {
+        auto a = _mm_sub_pd(c, _mm_cvtepi32_pd(_mm_loadl_epi64((const __m128i *)(xy + 2 * i))));
+        auto b = _mm_sub_pd(c, _mm_cvtepi32_pd(_mm_loadl_epi64((const __m128i *)(xy + 2 * i + 2))));
+        a = _mm_mul_pd(a, a);
+        b = _mm_mul_pd(b, b);
+        _mm_storeu_pd(dist + i, _mm_sqrt_pd(_mm_add_pd(_mm_unpacklo_pd(a, b), _mm_unpackhi_pd(a, b))));
+    }
+#endif
+    for (; i < n; i++) {
+        double dx = center.x - points[i].x, dy = center.y - points[i].y;
+        dist[i] = std::sqrt(dx * dx + dy * dy);
+    }
+}
+
+/* ---------------------------------------------------------------------------------------------- */
+/* Same as above in single precision, which processes twice as many points per instruction but is */
+/* only accurate to about 1e-7 of the distance.                                                   */
+/* ---------------------------------------------------------------------------------------------- */
+inline void distances(const cv::Point *points, size_t n, const cv::Point2d &center, float *dist)
+{
+    auto xy = reinterpret_cast<const int *>(points);
+    float cx = (float)center.x, cy = (float)center.y;
+    size_t i = 0;
+#if defined(__AVX__)
+    auto c = _mm256_setr_ps(cx, cy, cx, cy, cx, cy, cx, cy);
+    for (; i + 8 <= n; i += 8) {
+        auto a = _mm256_sub_ps(c, _mm256_cvtepi32_ps(_mm256_loadu_si256((const __m256i *)(xy + 2 * i))));
+        auto b = _mm256_sub_ps(c, _mm256_cvtepi32_ps(_mm256_loadu_si256((const __m256i *)(xy + 2 * i + 8))));
+        _mm256_storeu_ps(dist + i, _mm256_sqrt_ps(_mm256_hadd_ps(_mm256_mul_ps(a, a), _mm256_mul_ps(b, b))));
+    }
+#elif defined(__SSE2__)
+    auto c = _mm_setr_ps(cx, cy, cx, cy);
+    for (; i + 4 <= n; i += 4) {
+        auto a = _mm_sub_ps(c, _mm_cvtepi32_ps(_mm_loadu_si128((const __m128i *)(xy + 2 * i))));
+        auto b = _mm_sub_ps(c, _mm_cvtepi32_ps(_mm_loadu_si128((const __m128i *)(xy + 2 * i + 4))));
+        a = _mm_mul_ps(a, a);
+        b = _mm_mul_ps(b, b);
+        auto squares = _mm_add_ps(_mm_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0)),
+                                  _mm_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1)));
+        _mm_storeu_ps(dist + i, _mm_sqrt_ps(squares));
+    }
+#endif
+    for (; i < n; i++) {
+        float dx = cx - (float)points[i].x, dy = cy - (float)points[i].y;
+        dist[i] = std::sqrt(dx * dx + dy * dy);
+    }
+}
+
+#endif //OBJECTDETECTOR_FILTERKERNELS_HPP
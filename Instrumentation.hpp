@@ -0,0 +1,134 @@
+/* ============================================================================================== */
+/* Instrumentation.hpp                                                                            */
+/*                                                                                                */
+/* This file is part of ObjectDetector (github.com/joostvanstuijvenberg/ObjectDetector.git)       */
+/*                                                                                                */
+/* Joost van Stuijvenberg                                                                         */
+/* ============================================================================================== */
+
+#ifndef OBJECTDETECTOR_INSTRUMENTATION_HPP
+#define OBJECTDETECTOR_INSTRUMENTATION_HPP
+
+#include <algorithm>
+#include <chrono>
+#include <iomanip>
+#include <ostream>
+#include <vector>
+
+#include "Filter.hpp"
+
+/* ---------------------------------------------------------------------------------------------- */
+/* Stages of ObjectDetector::detect()                                                             */
+/* ---------------------------------------------------------------------------------------------- */
+enum DetectionStage {
+    STAGE_GRAYSCALE,
+    STAGE_THRESHOLD,
+    STAGE_FIND_CONTOURS,
+    STAGE_MOMENTS,
+    STAGE_FILTERS,
+    STAGE_RADIUS,
+    STAGE_GROUPING,
+    STAGE_KEYPOINTS,
+    STAGE_COUNT
+};
+
+inline const char *stageName(int stage)
+{
+    static const char *names[STAGE_COUNT] = {"grayscale", "threshold", "findContours", "moments", "filters", "radius",
+                                             "grouping", "keypoints"};
+    return names[stage];
+}
+
+typedef std::chrono::steady_clock TraceClock;
+
+/* ---------------------------------------------------------------------------------------------- */
+/* Seconds elapsed since the given moment.                                                        */
+/* ---------------------------------------------------------------------------------------------- */
+inline double traceTime(const TraceClock::time_point &origin)
+{
+    return std::chrono::duration<double>(TraceClock::now() - origin).count();
+}
+
+/* ---------------------------------------------------------------------------------------------- */
+/* A stage that was executed from start to start + duration (both in seconds since the start of   */
+/* detect()), for the given level (or -1 when it is not specific to a level) on the given thread. */
+/* ---------------------------------------------------------------------------------------------- */
+struct TraceEvent
+{
+    DetectionStage stage;
+    int level;
+    int thread;
+    double start;
+    double duration;
+};
+
+/* ---------------------------------------------------------------------------------------------- */
+/* Detection trace                                                                                */
+/*                                                                                                */
+/* The timings and counters of the last call to detect(), filled when the detector's              */
+/* instrumentation is switched on. Stages that are executed per contour (moments, filters and     */
+/* radius) are timed per contour, but appear in the events as one block per level with their      */
+/* total duration, right after findContours.                                                      */
+/* ---------------------------------------------------------------------------------------------- */
+struct DetectionTrace
+{
+    TraceClock::time_point origin;
+    std::vector<TraceEvent> events;
+    // Total time spent in each stage, summed over all levels and threads.
+    double seconds[STAGE_COUNT] = {};
+    // Number of contours found and number of objects that passed the filters, per level.
+    std::vector<size_t> contours;
+    std::vector<size_t> objects;
+    // Evaluations and rejections of each filter (in the order they were added) during this call.
+    std::vector<FilterStatistics> filters;
+    // Number of images whose data had to be (re)allocated during this call.
+    size_t imageAllocations = 0;
+
+    inline void clear();
+    inline double elapsed() const { return traceTime(origin); }
+    inline void add(DetectionStage stage, int level, int thread, double start, double end) {
+        events.push_back(TraceEvent{stage, level, thread, start, end - start});
+        seconds[stage] += end - start;
+    }
+    inline void writeChromeTrace(std::ostream &os) const;
+};
+
+void DetectionTrace::clear()
+{
+    origin = TraceClock::now();
+    events.clear();
+    std::fill(seconds, seconds + STAGE_COUNT, 0.0);
+    contours.clear();
+    objects.clear();
+    filters.clear();
+    imageAllocations = 0;
+}
+
+/* ---------------------------------------------------------------------------------------------- */
+/* Writes the events in Chrome's trace event format, which can be loaded in chrome://tracing or   */
+/* Perfetto. Times are in microseconds since the start of detect(), with three decimals, so that  */
+/* late events keep their resolution. The formatting of the stream is restored afterwards.        */
+/* ---------------------------------------------------------------------------------------------- */
+void DetectionTrace::writeChromeTrace(std::ostream &os) const
+{
+    auto flags = os.flags();
+    auto precision = os.precision();
+    os << std::fixed << std::setprecision(3) << "{\"traceEvents\":[";
+    for (size_t i = 0; i < events.size(); i++) {
+        auto &e = events[i];
+        os << (i == 0 ? "" : ",") << "\n{\"name\":\"" << stageName(e.stage) << "\",\"cat\":\"detect\",\"ph\":\"X\""
+           << ",\"ts\":" << e.start * 1e6 << ",\"dur\":" << e.duration * 1e6 << ",\"pid\":1,\"tid\":" << e.thread;
+        if (e.level >= 0) {
+            os << ",\"args\":{\"level\":" << e.level;
+            if (e.stage == STAGE_FIND_CONTOURS && (size_t)e.level < contours.size())
+                os << ",\"contours\":" << contours[e.level] << ",\"objects\":" << objects[e.level];
+            os << "}";
+        }
+        os << "}";
+    }
+    os << "\n],\"displayTimeUnit\":\"ms\"}" << std::endl;
+    os.flags(flags);
+    os.precision(precision);
+}
+
+#endif //OBJECTDETECTOR_INSTRUMENTATION_HPP
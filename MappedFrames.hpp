@@ -0,0 +1,234 @@
+/* ============================================================================================== */
+/* MappedFrames.hpp                                                                               */
+/*                                                                                                */
+/* This file is part of ObjectDetector (github.com/joostvanstuijvenberg/ObjectDetector.git)       */
+/*                                                                                                */
+/* Joost van Stuijvenberg                                                                         */
+/* ============================================================================================== */
+
+#ifndef OBJECTDETECTOR_MAPPEDFRAMES_HPP
+#define OBJECTDETECTOR_MAPPEDFRAMES_HPP
+
+#include <algorithm>
+#include <cctype>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "opencv2/opencv.hpp"
+
+/* ---------------------------------------------------------------------------------------------- */
+/* Memory-mapped frames                                                                           */
+/*                                                                                                */
+/* Gives access to the frames in a file of raw 8-bit frames (Y8 or BGR24, all of the same size,   */
+/* optionally after a header) or in a PGM/PPM file (P5 or P6 with a maximum value below 256, one  */
+/* image or several concatenated ones). The file is mapped into memory and each frame is a        */
+/* cv::Mat header on the mapped data, so frames are neither decoded nor copied, and the pages of  */
+/* a frame are only read from disk when it is used. Grayscale frames can be passed to detect()    */
+/* as they are; BGR frames are converted by detect() as usual. PPM files hold RGB rather than BGR */
+/* data, which detect() would convert with the wrong weights; frame() refuses those frames, and   */
+/* grayFrame() must be used instead.                                                              */
+/*                                                                                                */
+/* The file is read sequentially: when a frame is asked for, the kernel is told that the next     */
+/* readahead frames will be needed soon, so that they are read while the current one is being     */
+/* processed. The frames are read-only and remain valid until the file is closed. This uses the   */
+/* POSIX mmap() interface.                                                                        */
+/* ---------------------------------------------------------------------------------------------- */
+class MappedFrames {
+public:
+    inline MappedFrames() = default;
+    inline ~MappedFrames() { close(); }
+    MappedFrames(const MappedFrames &) = delete;
+    MappedFrames &operator=(const MappedFrames &) = delete;
+    inline bool openRaw(const std::string &path, const cv::Size &size, int type, size_t headerBytes = 0);
+    inline bool openPnm(const std::string &path);
+    inline void close();
+    inline bool isOpened() const { return _data != nullptr; }
+    inline size_t count() const { return _frames.size(); }
+    inline bool rgb() const { return _rgb; }
+    inline size_t readahead() const { return _readahead; }
+    inline void readahead(size_t readahead) { _readahead = readahead; }
+    inline cv::Mat frame(size_t i) const;
+    inline cv::Mat grayFrame(size_t i, cv::Mat &gray) const;
+private:
+    struct Frame
+    {
+        size_t offset;
+        cv::Size size;
+        int type;
+        inline size_t bytes() const { return (size_t)size.width * size.height * CV_ELEM_SIZE(type); }
+    };
+    uchar *_data = nullptr;
+    size_t _length = 0;
+    bool _rgb = false;
+    size_t _readahead = 2;
+    std::vector<Frame> _frames;
+    inline bool map(const std::string &path);
+    inline void advise(size_t begin, size_t end, int advice) const;
+    inline cv::Mat view(size_t i) const;
+};
+
+/* ---------------------------------------------------------------------------------------------- */
+/* Opens a file of raw frames of the given size and type (CV_8UC1 for Y8, CV_8UC3 for BGR24),     */
+/* which follow each other directly after headerBytes bytes. A partial frame at the end is        */
+/* ignored. Returns false when the file could not be mapped or holds no complete frame.           */
+/* ---------------------------------------------------------------------------------------------- */
+bool MappedFrames::openRaw(const std::string &path, const cv::Size &size, int type, size_t headerBytes)
+{
+    assert(type == CV_8UC1 || type == CV_8UC3);
+    assert(size.width > 0 && size.height > 0);
+    if (!map(path))
+        return false;
+    Frame frame{headerBytes, size, type};
+    for (; frame.offset + frame.bytes() <= _length; frame.offset += frame.bytes())
+        _frames.push_back(frame);
+    if (_frames.empty()) {
+        close();
+        return false;
+    }
+    advise(0, _length, MADV_SEQUENTIAL);
+    return true;
+}
+
+/* ---------------------------------------------------------------------------------------------- */
+/* Opens a binary PGM (P5) or PPM (P6) file, which may hold several images one after the other.   */
+/* Returns false when the file could not be mapped, or is not a PGM or PPM file with 8-bit        */
+/* samples; of a file that breaks off, the complete images are kept.                              */
+/* ---------------------------------------------------------------------------------------------- */
+bool MappedFrames::openPnm(const std::string &path)
+{
+    if (!map(path))
+        return false;
+
+    // The header is the magic number, width, height and maximum value, separated by whitespace and
+    // comments, followed by a single whitespace character.
+    size_t p = 0;
+    auto number = [&](int &value) {
+        for (;;) {
+            while (p < _length && std::isspace(_data[p]))
+                p++;
+            if (p < _length && _data[p] == '#')
+                while (p < _length && _data[p] != '\n')
+                    p++;
+            else
+                break;
+        }
+        if (p == _length || !std::isdigit(_data[p]))
+            return false;
+        for (value = 0; p < _length && std::isdigit(_data[p]); p++)
+            value = std::min(10 * value + (_data[p] - '0'), 1 << 24);
+        return value < 1 << 24;
+    };
+    while (p + 2 <= _length && _data[p] == 'P' && (_data[p + 1] == '5' || _data[p + 1] == '6')) {
+        int type = _data[p + 1] == '5' ? CV_8UC1 : CV_8UC3;
+        p += 2;
+        int width, height, maxValue;
+        if (!number(width) || !number(height) || !number(maxValue) || width == 0 || height == 0 ||
+            maxValue == 0 || maxValue > 255 || p == _length || !std::isspace(_data[p]))
+            break;
+        Frame frame{p + 1, cv::Size(width, height), type};
+        if (frame.offset + frame.bytes() > _length)
+            break;
+        _frames.push_back(frame);
+        _rgb = _rgb || type == CV_8UC3;
+        p = frame.offset + frame.bytes();
+        while (p < _length && std::isspace(_data[p]))
+            p++;
+    }
+    if (_frames.empty()) {
+        close();
+        return false;
+    }
+    advise(0, _length, MADV_SEQUENTIAL);
+    return true;
+}
+
+/* ---------------------------------------------------------------------------------------------- */
+/* Unmaps the file. Frames obtained before are no longer valid.                                   */
+/* ---------------------------------------------------------------------------------------------- */
+void MappedFrames::close()
+{
+    if (_data != nullptr)
+        munmap(_data, _length);
+    _data = nullptr;
+    _length = 0;
+    _rgb = false;
+    _frames.clear();
+}
+
+/* ---------------------------------------------------------------------------------------------- */
+/* Frame i, as a read-only header on the mapped data. Asks the kernel to read the next frames.    */
+/* The color frames of a PPM file are RGB rather than BGR, and are refused: an empty matrix is    */
+/* returned, and grayFrame() should be used instead.                                              */
+/* ---------------------------------------------------------------------------------------------- */
+cv::Mat MappedFrames::frame(size_t i) const
+{
+    assert(i < _frames.size());
+    if (_rgb && _frames[i].type == CV_8UC3)
+        return cv::Mat();
+    return view(i);
+}
+
+/* ---------------------------------------------------------------------------------------------- */
+/* Frame i in grayscale: the frame itself when it has a single channel, or else converted into    */
+/* gray, with the channel order of the file.                                                      */
+/* ---------------------------------------------------------------------------------------------- */
+cv::Mat MappedFrames::grayFrame(size_t i, cv::Mat &gray) const
+{
+    assert(i < _frames.size());
+    auto image = view(i);
+    if (image.channels() == 1)
+        return image;
+    cvtColor(image, gray, _rgb ? cv::COLOR_RGB2GRAY : cv::COLOR_BGR2GRAY);
+    return gray;
+}
+
+/* ---------------------------------------------------------------------------------------------- */
+bool MappedFrames::map(const std::string &path)
+{
+    close();
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+        return false;
+    struct stat status;
+    if (fstat(fd, &status) == 0 && status.st_size > 0) {
+        void *data = mmap(nullptr, (size_t)status.st_size, PROT_READ, MAP_SHARED, fd, 0);
+        if (data != MAP_FAILED) {
+            _data = static_cast<uchar *>(data);
+            _length = (size_t)status.st_size;
+        }
+    }
+    // The mapping keeps the file open.
+    ::close(fd);
+    return _data != nullptr;
+}
+
+/* ---------------------------------------------------------------------------------------------- */
+/* Frame i, whatever its channel order, after asking the kernel to read the next frames.          */
+/* ---------------------------------------------------------------------------------------------- */
+cv::Mat MappedFrames::view(size_t i) const
+{
+    auto &f = _frames[i];
+    if (_readahead > 0 && i + 1 < _frames.size()) {
+        auto &last = _frames[std::min(i + _readahead, _frames.size() - 1)];
+        advise(_frames[i + 1].offset, last.offset + last.bytes(), MADV_WILLNEED);
+    }
+    return cv::Mat(f.size, f.type, _data + f.offset);
+}
+
+/* ---------------------------------------------------------------------------------------------- */
+/* Gives the kernel advice about the bytes begin up to end, extended to whole pages.              */
+/* ---------------------------------------------------------------------------------------------- */
+void MappedFrames::advise(size_t begin, size_t end, int advice) const
+{
+    static const size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    begin -= begin % page;
+    if (end > begin)
+        madvise(_data + begin, end - begin, advice);
+}
+
+#endif //OBJECTDETECTOR_MAPPEDFRAMES_HPP
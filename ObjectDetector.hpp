@@ -9,46 +9,411 @@
 #ifndef OBJECTDETECTOR_OBJECTDETECTOR_HPP
 #define OBJECTDETECTOR_OBJECTDETECTOR_HPP
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <exception>
+#include <functional>
+#include <limits>
+#include <numeric>
+#include <thread>
+#include <typeindex>
 #include <utility>
 #include <vector>
 
 #include "opencv2/opencv.hpp"
 
+#include "CenterGrouping.hpp"
+#include "DetectionResult.hpp"
 #include "Filter.hpp"
+#include "Instrumentation.hpp"
 #include "Persistence.hpp"
+#include "RunLengthLabeler.hpp"
 #include "ThresholdAlgorithm.hpp"
+#include "WorkerPool.hpp"
+
+/* ---------------------------------------------------------------------------------------------- */
+/* Statistics gathered while processing a single level.                                           */
+/* ---------------------------------------------------------------------------------------------- */
+struct LevelStatistics
+{
+    int level = 0;
+    ContourFeatureCounters features;
+    std::vector<FilterStatistics> filters;
+    size_t contours = 0;
+    size_t objects = 0;
+    // Only filled when instrumentation is switched on.
+    TraceClock::time_point origin;
+    std::thread::id thread;
+    std::vector<TraceEvent> events;
+    double contourStart = 0;
+    double seconds[STAGE_COUNT] = {};
+};
+
+/* ---------------------------------------------------------------------------------------------- */
+/* The buffers a worker uses while finding the objects in a level. They are kept in the detection */
+/* context and reused for every level of every frame; emptying them keeps their capacity, so once */
+/* they have grown large enough, finding objects no longer allocates memory for them. Emptying is */
+/* not free, though: the contours are overwritten one by one by the next findContours().          */
+/* ---------------------------------------------------------------------------------------------- */
+struct LevelScratch
+{
+    // The regions of a run-length encoded level, and the labeler that finds them.
+    RunLengthLabeler labeler;
+    std::vector<Region> regions;
+    std::vector<std::vector<cv::Point>> contours;
+    ContourBatch batch;
+    cv::Mat labels, stats, centroids;
+    std::vector<double> distances;
+    std::vector<float> floatDistances;
+};
+
+/* ---------------------------------------------------------------------------------------------- */
+/* Detection context                                                                              */
+/*                                                                                                */
+/* Holds all the scratch state of a call to ObjectDetector::detect(). The buffers are reused by   */
+/* subsequent calls, so that no image data needs to be allocated once they have been filled for   */
+/* an image of a given size. Each thread that calls detect() needs its own context.               */
+/* ---------------------------------------------------------------------------------------------- */
+struct DetectionContext
+{
+    inline DetectionContext() = default;
+    // Copying a context yields a fresh one; scratch state is never shared.
+    inline DetectionContext(const DetectionContext &) : DetectionContext() {}
+    inline DetectionContext &operator=(const DetectionContext &) { return *this; }
+
+    cv::Mat gray;
+    std::vector<cv::Mat> binaryImages;
+    // The run-length encoded binary images, when the detector stores its levels that way.
+    std::vector<RunLengthImage> runLengthImages;
+    std::vector<std::vector<Region>> regions;
+    std::vector<std::vector<Center>> levels;
+    // The attributes the caller of detect() asked for, and the single level attributes of the objects
+    // of each level, when there are any among them.
+    int attributes = 0;
+    std::vector<DetectionResult> levelObjects;
+    inline DetectionResult *objects(size_t level) {
+        return (attributes & LEVEL_ATTRIBUTES) != 0 ? &levelObjects[level] : nullptr;
+    }
+    // The number of threshold levels each binary image stands for; see ThresholdAlgorithm::binaryImages().
+    std::vector<int> levelCounts;
+    std::vector<LevelStatistics> levelStatistics;
+    // One for each worker.
+    std::vector<LevelScratch> scratch;
+    CenterGrouping grouping;
+    // How often the filters asked for each contour feature, and how often it was computed, summed over
+    // all levels of the last call to detect().
+    ContourFeatureCounters featureCounters;
+    // The order in which the filters are evaluated, as indices into the detector's filters, and the
+    // statistics of each filter (by the same index) since the filters were last changed. The generation
+    // tells which filters they belong to; see ObjectDetector::changeFilters().
+    size_t filterGeneration = 0;
+    std::vector<size_t> filterOrder;
+    std::vector<FilterStatistics> filterStatistics;
+    size_t evaluationsSinceReorder = 0;
+    // Timings and counters of the last call to detect(), when the instrumentation is switched on.
+    DetectionTrace trace;
+    // The scratch state of the threshold algorithm, which only fits algorithms of the type that created
+    // it. An ObjectDetector also keeps the algorithm itself; a StaticObjectDetector only its type.
+    std::shared_ptr<const ThresholdAlgorithm> thresholdAlgorithm;
+    std::type_index thresholdAlgorithmType = typeid(void);
+    std::unique_ptr<ThresholdContext> thresholdContext;
+    // Set by detectTiled(), which distributes tiles over the workers rather than levels.
+    bool sequentialLevels = false;
+    // The threads that help the calling thread with the levels, kept from call to call.
+    WorkerPool workerPool;
+    // The downsampled image, its binary images and the regions of interest found in it by the last
+    // call to detect() in pyramid mode.
+    cv::Mat coarse;
+    std::vector<cv::Mat> coarseBinaryImages;
+    std::vector<cv::Rect> regionsOfInterest;
+    // The objects found in a single region of interest, when a detection result was asked for.
+    DetectionResult regionObjects;
+};
+
+/* ---------------------------------------------------------------------------------------------- */
+/* Reads the given part of an image for tiled detection. The tile may refer to the source image   */
+/* (e.g. a region of interest) or be read into the given matrix, which is reused between tiles.   */
+/* ---------------------------------------------------------------------------------------------- */
+typedef std::function<void(const cv::Rect &rect, cv::Mat &tile)> TileReader;
+
+/* ---------------------------------------------------------------------------------------------- */
+/* Stores the location and radius of an object in center: its centroid, and the median distance   */
+/* from the centroid to the points of its contour. Objects found by labeling connected components */
+/* have no contour; they get the radius of a disk with the same number of pixels instead (up to   */
+/* the centers of its boundary pixels, like a contour). dists is scratch space for the distances; */
+/* with a vector of floats, they are computed in single precision, which is faster but only       */
+/* approximately the same.                                                                        */
+/* ---------------------------------------------------------------------------------------------- */
+template<typename T>
+inline void locateObject(const ContourFeatures &features, Center &center, std::vector<T> &dists)
+{
+    center.location = features.centroid();
+    auto &contour = features.contour();
+    if (contour.empty()) {
+        center.radius = std::max(0.5, std::sqrt(features.area() / CV_PI) - 0.5);
+        return;
+    }
+    dists.resize(contour.size());
+    distances(contour.data(), contour.size(), center.location, dists.data());
+
+    // The median: the middle distance, or the mean of the two middle ones. Selecting these is enough;
+    // the distances do not need to be sorted.
+    auto lower = dists.begin() + (dists.size() - 1) / 2;
+    std::nth_element(dists.begin(), lower, dists.end());
+    double upper = *lower;
+    if (dists.size() % 2 == 0)
+        upper = *std::min_element(lower + 1, dists.end());
+    center.radius = ((double)*lower + upper) / 2.;
+}
+
+inline void locateObject(const ContourFeatures &features, Center &center)
+{
+    std::vector<double> dists;
+    locateObject(features, center, dists);
+}
+
+/* ---------------------------------------------------------------------------------------------- */
+/* Adds an object that was located in the given level to the objects of that level, with the      */
+/* attributes they ask for, and stores its place among them in center. Features the filters have  */
+/* computed already are not computed again.                                                       */
+/* ---------------------------------------------------------------------------------------------- */
+inline void recordObject(const ContourFeatures &features, int level, Center &center, DetectionResult &objects)
+{
+    center.level = level;
+    center.object = (int)objects.count();
+    objects.x.push_back((float)center.location.x);
+    objects.y.push_back((float)center.location.y);
+    objects.size.push_back((float)center.radius * 2.0f);
+    if (objects.has(ATTRIBUTE_AREA))
+        objects.area.push_back(features.area());
+    if (objects.has(ATTRIBUTE_BOUNDS))
+        objects.bounds.push_back(features.boundingRect());
+    if (objects.has(ATTRIBUTE_CIRCULARITY)) {
+        double perimeter = features.perimeter();
+        objects.circularity.push_back((float)(4 * CV_PI * features.area() / (perimeter * perimeter)));
+    }
+    if (objects.has(ATTRIBUTE_INERTIA))
+        objects.inertia.push_back((float)features.inertiaRatio());
+    if (objects.has(ATTRIBUTE_CONTOUR)) {
+        auto &contour = features.contour();
+        objects.contourPoints.insert(objects.contourPoints.end(), contour.begin(), contour.end());
+        objects.contourStart.push_back((uint32_t)objects.contourPoints.size());
+    }
+}
+
+/* ---------------------------------------------------------------------------------------------- */
+/* The confidence-weighted mean location of a group of centers; normalizer receives the sum of    */
+/* their confidences.                                                                             */
+/* ---------------------------------------------------------------------------------------------- */
+inline cv::Point2d groupLocation(const std::vector<Center> &group, double &normalizer)
+{
+    cv::Point2d sumPoint(0, 0);
+    normalizer = 0;
+    for (auto &j : group) {
+        sumPoint += j.confidence * j.location;
+        normalizer += j.confidence;
+    }
+    sumPoint *= (1. / normalizer);
+    return sumPoint;
+}
+
+/* ---------------------------------------------------------------------------------------------- */
+/* Converts groups of centers into keypoints, at the confidence-weighted mean location and the    */
+/* median radius of each group. Groups with less than minRepeatability centers are omitted.       */
+/* ---------------------------------------------------------------------------------------------- */
+inline std::vector<cv::KeyPoint> groupKeypoints(const std::vector<std::vector<Center>> &groups,
+                                                size_t minRepeatability)
+{
+    std::vector<cv::KeyPoint> keypoints;
+    for (auto &center : groups) {
+        if (center.size() < minRepeatability)
+            continue;
+        double normalizer;
+        cv::KeyPoint kpt(groupLocation(center, normalizer), (float) (center[center.size() / 2].radius) * 2.0f);
+        keypoints.push_back(kpt);
+    }
+    return keypoints;
+}
+
+/* ---------------------------------------------------------------------------------------------- */
+/* Same as groupKeypoints(), but appends the objects to a detection result, with the attributes   */
+/* it asks for. The single level attributes are those of the center with the median radius, taken */
+/* from the objects of its level.                                                                 */
+/* ---------------------------------------------------------------------------------------------- */
+inline void groupResult(const std::vector<std::vector<Center>> &groups, size_t minRepeatability,
+                        const std::vector<DetectionResult> &levelObjects, DetectionResult &result)
+{
+    for (auto &group : groups) {
+        if (group.size() < minRepeatability)
+            continue;
+        double normalizer;
+        cv::Point2f location = groupLocation(group, normalizer);
+        auto &median = group[group.size() / 2];
+        result.x.push_back(location.x);
+        result.y.push_back(location.y);
+        result.size.push_back((float)(median.radius) * 2.0f);
+        if (result.has(ATTRIBUTE_CONFIDENCE))
+            result.confidence.push_back((float)(normalizer / group.size()));
+        if (result.has(ATTRIBUTE_REPEATABILITY))
+            result.repeatability.push_back((int)group.size());
+        if ((result.attributes & LEVEL_ATTRIBUTES) != 0)
+            result.addAttributes(levelObjects[median.level], (size_t)median.object);
+    }
+}
+
+/* ---------------------------------------------------------------------------------------------- */
+/* Whether an object found in a window of an image may be cut off by the edge of the window: it   */
+/* reaches an edge of the window that is not an edge of the image. Its center and size would then */
+/* be wrong.                                                                                      */
+/* ---------------------------------------------------------------------------------------------- */
+inline bool cutOff(const cv::KeyPoint &keypoint, const cv::Rect &window, const cv::Size &image)
+{
+    float r = keypoint.size / 2;
+    return (window.x > 0 && keypoint.pt.x - r <= 0) ||
+           (window.y > 0 && keypoint.pt.y - r <= 0) ||
+           (window.x + window.width < image.width && keypoint.pt.x + r >= window.width - 1) ||
+           (window.y + window.height < image.height && keypoint.pt.y + r >= window.height - 1);
+}
+
+/* ---------------------------------------------------------------------------------------------- */
+/* Replaces overlapping rectangles by their bounding rectangle, until none of them overlap.       */
+/* ---------------------------------------------------------------------------------------------- */
+inline void mergeOverlapping(std::vector<cv::Rect> &rects)
+{
+    auto left = [](const cv::Rect &a, const cv::Rect &b) { return a.x < b.x; };
+    std::sort(rects.begin(), rects.end(), left);
+    for (bool merged = true; merged;) {
+        merged = false;
+        for (size_t i = 0; i < rects.size(); i++)
+            for (size_t j = i + 1; j < rects.size() && rects[j].x < rects[i].x + rects[i].width; j++)
+                if ((rects[i] & rects[j]).area() > 0) {
+                    rects[i] |= rects[j];
+                    rects.erase(rects.begin() + j);
+                    merged = true;
+                    j = i;
+                }
+        std::sort(rects.begin(), rects.end(), left);
+    }
+}
 
 /* ---------------------------------------------------------------------------------------------- */
 /* Object detector                                                                                */
+/*                                                                                                */
+/* Once configured, a single object detector can be shared by several threads: detect() with a    */
+/* DetectionContext does not change the detector, so it only needs one context per thread.        */
 /* ---------------------------------------------------------------------------------------------- */
 class ObjectDetector {
 public:
     inline explicit ObjectDetector(double minDistBetweenObjects = 10.0);
     inline void setThresholdAlgorithm(std::shared_ptr<ThresholdAlgorithm> thresholdAlgorithm) { _thresholdAlgorithm = std::move(
                 thresholdAlgorithm); }
-    inline double minDistBetweenObjects() { return _minDistBetweenObjects; }
+    inline double minDistBetweenObjects() const { return _minDistBetweenObjects; }
     inline void minDistBetweenObjects(double minDistBetweenObjects) { _minDistBetweenObjects = minDistBetweenObjects; }
+    inline unsigned int workers() const { return _workers; }
+    inline void workers(unsigned int workers) { _workers = workers; }
     inline void registerFilter(const std::string key, const std::shared_ptr<Filter> filter) { _registeredFilters.emplace(key, filter); }
-    inline void addFilter(const std::shared_ptr<Filter> filter) { _filters.emplace_back(filter); }
-    inline void clearFilters() { _filters.clear(); }
-    std::vector<cv::KeyPoint> detect(const cv::Mat& image);
+    inline void addFilter(const std::shared_ptr<Filter> filter) { _filters.emplace_back(filter); changeFilters(); }
+    inline void clearFilters() { _filters.clear(); changeFilters(); }
+    inline bool adaptiveFilterOrder() const { return _adaptiveFilterOrder; }
+    inline void adaptiveFilterOrder(bool adaptiveFilterOrder) { _adaptiveFilterOrder = adaptiveFilterOrder; }
+    inline size_t filterReorderInterval() const { return _filterReorderInterval; }
+    inline void filterReorderInterval(size_t filterReorderInterval) { _filterReorderInterval = filterReorderInterval; }
+    inline bool batchFilters() const { return _batchFilters; }
+    inline void batchFilters(bool batchFilters) { _batchFilters = batchFilters; }
+    inline bool floatRadius() const { return _floatRadius; }
+    inline void floatRadius(bool floatRadius) { _floatRadius = floatRadius; }
+    inline bool runLengthLevels() const { return _runLengthLevels; }
+    inline bool connectedComponents() const { return _connectedComponents; }
+    inline void connectedComponents(bool connectedComponents) { _connectedComponents = connectedComponents; }
+    inline void runLengthLevels(bool runLengthLevels) { _runLengthLevels = runLengthLevels; }
+    inline bool instrumentation() const { return _instrumentation; }
+    inline void instrumentation(bool instrumentation) { _instrumentation = instrumentation; }
+    inline std::vector<cv::KeyPoint> detect(const cv::Mat& image) { return detect(image, _context); }
+    inline const ContourFeatureCounters &featureCounters() const { return _context.featureCounters; }
+    inline const std::vector<FilterStatistics> &filterStatistics() const { return _context.filterStatistics; }
+    inline const std::vector<size_t> &filterOrder() const { return _context.filterOrder; }
+    inline const DetectionTrace &trace() const { return _context.trace; }
+    std::vector<cv::KeyPoint> detect(const cv::Mat& image, DetectionContext &context) const;
+    inline void detect(const cv::Mat &image, DetectionResult &result) { detect(image, result, _context); }
+    void detect(const cv::Mat &image, DetectionResult &result, DetectionContext &context) const;
+    inline int pyramidLevels() const { return _pyramidLevels; }
+    inline void pyramidLevels(int pyramidLevels) { _pyramidLevels = pyramidLevels; }
+    inline const std::vector<cv::Rect> &regionsOfInterest() const { return _context.regionsOfInterest; }
+    inline int tileSize() const { return _tileSize; }
+    inline void tileSize(int tileSize) { _tileSize = tileSize; }
+    inline int tileHalo() const;
+    inline void tileHalo(int tileHalo) { _tileHalo = tileHalo; }
+    std::vector<cv::KeyPoint> detectTiled(const cv::Mat &image) const;
+    std::vector<cv::KeyPoint> detectTiled(const cv::Size &size, const TileReader &readTile) const;
     inline void read(const cv::FileNode &node);
     inline void write(cv::FileStorage &storage) const;
 protected:
-    std::vector<Center> findObjects(const cv::Mat &originalImage, const cv::Mat &binaryImage);
+    void findObjects(const cv::Mat &originalImage, const cv::Mat &binaryImage, const std::vector<size_t> &filterOrder,
+                     LevelScratch &scratch, LevelStatistics &statistics, std::vector<Center> &centers,
+                     DetectionResult *objects) const;
+    void findObjects(const cv::Mat &originalImage, const std::vector<Region> &regions,
+                     const std::vector<size_t> &filterOrder, LevelScratch &scratch, LevelStatistics &statistics,
+                     std::vector<Center> &centers, DetectionResult *objects) const;
+    void findObjects(const cv::Mat &originalImage, const std::vector<cv::Mat> &binaryImages,
+                     DetectionContext &context) const;
+    void findObjects(const cv::Mat &originalImage, const std::vector<std::vector<Region>> &regions,
+                     DetectionContext &context) const;
+    void findObjects(const cv::Mat &originalImage, const std::vector<RunLengthImage> &levels,
+                     DetectionContext &context) const;
+    void findComponents(const cv::Mat &originalImage, const cv::Mat &binaryImage,
+                        const std::vector<size_t> &filterOrder, LevelScratch &scratch, LevelStatistics &statistics,
+                        std::vector<Center> &centers, DetectionResult *objects) const;
+    bool acceptObject(const ContourFeatures &features, const std::vector<size_t> &filterOrder, LevelScratch &scratch,
+                      LevelStatistics &statistics, Center &center, DetectionResult *objects) const;
+    void acceptObjects(const cv::Mat &originalImage, const cv::Mat &binaryImage, LevelFeatures *level,
+                       const std::vector<size_t> &filterOrder, LevelScratch &scratch, LevelStatistics &statistics,
+                       std::vector<Center> &centers, DetectionResult *objects) const;
 private:
+    template<typename F> void forEachLevel(WorkerPool &pool, size_t count, F process, bool sequential = false) const;
+    std::vector<cv::KeyPoint> detectLevels(const cv::Mat &image, DetectionContext &context,
+                                           DetectionResult *result) const;
+    std::vector<cv::KeyPoint> detectPyramid(const cv::Mat &image, DetectionContext &context,
+                                            DetectionResult *result) const;
+    void findRegionsOfInterest(const cv::Mat &gray, DetectionContext &context) const;
+    inline const AreaFilter *areaFilter() const;
+    inline void changeFilters();
+    void updateFilterOrder(DetectionContext &context) const;
+    inline void beginDetection(DetectionContext &context) const;
+    void prepareLevels(size_t count, DetectionContext &context) const;
+    void collectStatistics(DetectionContext &context) const;
     std::map<std::string, std::shared_ptr<ThresholdAlgorithm>> _registeredThresholdAlgorithms;
     std::shared_ptr<ThresholdAlgorithm> _thresholdAlgorithm;
     double _minDistBetweenObjects;
+    unsigned int _workers;
+    bool _adaptiveFilterOrder;
+    size_t _filterReorderInterval;
+    bool _batchFilters;
+    bool _floatRadius;
+    bool _runLengthLevels;
+    bool _connectedComponents;
+    bool _instrumentation;
+    int _pyramidLevels;
+    int _tileSize;
+    int _tileHalo;
     std::map<std::string, std::shared_ptr<Filter>> _registeredFilters;
     std::vector<std::shared_ptr<Filter>> _filters;
+    size_t _filterGeneration;
+    // The context used by detect() without a context of its own.
+    DetectionContext _context;
 };
 
 ObjectDetector::ObjectDetector(double minDistBetweenObjects)
-        : _minDistBetweenObjects(minDistBetweenObjects) {
+        : _minDistBetweenObjects(minDistBetweenObjects), _workers(1), _adaptiveFilterOrder(false),
+          _filterReorderInterval(1000), _batchFilters(false), _floatRadius(false),
+          _runLengthLevels(false), _connectedComponents(false), _instrumentation(false),
+          _pyramidLevels(0), _tileSize(2048), _tileHalo(0) {
+    changeFilters();
     _registeredThresholdAlgorithms.emplace("ThresholdFixedAlgorithm", std::make_shared<ThresholdFixedAlgorithm>());
     _registeredThresholdAlgorithms.emplace("ThresholdOtsuAlgorithm", std::make_shared<ThresholdOtsuAlgorithm>());
     _registeredThresholdAlgorithms.emplace("ThresholdRangeAlgorithm", std::make_shared<ThresholdRangeAlgorithm>());
+    _registeredThresholdAlgorithms.emplace("ThresholdComponentTreeAlgorithm", std::make_shared<ThresholdComponentTreeAlgorithm>());
+    _registeredThresholdAlgorithms.emplace("ThresholdAdaptiveAlgorithm", std::make_shared<ThresholdAdaptiveAlgorithm>());
 
     _registeredFilters.emplace("AreaFilter", std::make_shared<AreaFilter>());
     _registeredFilters.emplace("CircularityFilter", std::make_shared<CircularityFilter>());
@@ -59,113 +424,801 @@ ObjectDetector::ObjectDetector(double minDistBetweenObjects)
 }
 
 /* ---------------------------------------------------------------------------------------------- */
-std::vector<cv::KeyPoint> ObjectDetector::detect(const cv::Mat& image)
+std::vector<cv::KeyPoint> ObjectDetector::detect(const cv::Mat& image, DetectionContext &context) const
+{
+    beginDetection(context);
+    return _pyramidLevels > 0 ? detectPyramid(image, context, nullptr) : detectLevels(image, context, nullptr);
+}
+
+/* ---------------------------------------------------------------------------------------------- */
+/* Same as detect() above, but fills a detection result with the objects instead of returning     */
+/* keypoints, with the attributes the result asks for.                                            */
+/* ---------------------------------------------------------------------------------------------- */
+void ObjectDetector::detect(const cv::Mat &image, DetectionResult &result, DetectionContext &context) const
+{
+    result.clear();
+    beginDetection(context);
+    if (_pyramidLevels > 0)
+        detectPyramid(image, context, &result);
+    else
+        detectLevels(image, context, &result);
+}
+
+/* ---------------------------------------------------------------------------------------------- */
+/* Detects the objects in the image as a whole, at full resolution. When a result is given, the   */
+/* objects are appended to it rather than returned as keypoints.                                  */
+/* ---------------------------------------------------------------------------------------------- */
+std::vector<cv::KeyPoint> ObjectDetector::detectLevels(const cv::Mat& image, DetectionContext &context,
+                                                       DetectionResult *result) const
 {
     assert(image.data != nullptr);
     assert(_thresholdAlgorithm != nullptr);
+    context.attributes = result != nullptr ? result->attributes : 0;
+
+    auto &trace = context.trace;
+    bool timed = _instrumentation;
+    double start = timed ? trace.elapsed() : 0;
 
-    // Convert the image to grayscale, when needed.
+    // Convert the image to grayscale, when needed. Threshold algorithms that support it threshold a
+    // color image while converting it, in a single pass over the image.
+    std::vector<uchar *> data;
+    if (timed)
+        for (auto &binaryImage : context.binaryImages)
+            data.push_back(binaryImage.data);
     cv::Mat gray;
-    if (image.channels() == 3 || image.channels() == 4)
-        cvtColor(image, gray, cv::COLOR_BGR2GRAY);
-    else
+    bool thresholded = false;
+    if (image.channels() == 3 || image.channels() == 4) {
+        auto grayData = context.gray.data;
+        thresholded = !_runLengthLevels &&
+                      _thresholdAlgorithm->binaryImagesFromColor(image, context.gray, context.binaryImages,
+                                                                 context.levelCounts);
+        if (!thresholded)
+            cvtColor(image, context.gray, cv::COLOR_BGR2GRAY);
+        gray = context.gray;
+        if (timed && gray.data != grayData)
+            trace.imageAllocations++;
+    } else
         gray = image;
     assert(gray.type() == CV_8UC1);
+    if (timed) {
+        double end = trace.elapsed();
+        trace.add(thresholded ? STAGE_THRESHOLD : STAGE_GRAYSCALE, -1, 0, start, end);
+        start = end;
+    }
 
-    _thresholdAlgorithm->setImage(gray);
-
-    std::vector<std::vector<Center>> centers;
-    auto binaryImages = _thresholdAlgorithm->binaryImages();
-    for (auto binaryImage : binaryImages) {
-        auto curCenters = findObjects(gray, binaryImage);
-
-        // Find out the number of occurrences of each object.
-        std::vector<std::vector<Center> > newCenters;
-        for (auto &curCenter : curCenters) {
-            bool isNew = true;
-            for (auto &center : centers) {
-                double dist = norm(center[center.size() / 2].location - curCenter.location);
-                isNew = dist >= _minDistBetweenObjects && dist >= center[center.size() / 2].radius &&
-                        dist >= curCenter.radius;
-                if (!isNew) {
-                    center.push_back(curCenter);
-                    size_t k = center.size() - 1;
-                    while (k > 0 && center[k].radius < center[k - 1].radius) {
-                        center[k] = center[k - 1];
-                        k--;
-                    }
-                    center[k] = curCenter;
-                    break;
-                }
-            }
-            if (isNew)
-                newCenters.emplace_back(1, curCenter);
+    // The scratch state of the threshold algorithm belongs to this particular algorithm.
+    if (context.thresholdAlgorithm != _thresholdAlgorithm) {
+        context.thresholdAlgorithm = _thresholdAlgorithm;
+        context.thresholdAlgorithmType = typeid(*_thresholdAlgorithm);
+        context.thresholdContext = _thresholdAlgorithm->createContext();
+    }
+
+    // Start over with the filter statistics and order whenever the filters have changed.
+    if (context.filterGeneration != _filterGeneration) {
+        context.filterGeneration = _filterGeneration;
+        context.filterOrder.resize(_filters.size());
+        std::iota(context.filterOrder.begin(), context.filterOrder.end(), 0);
+        context.filterStatistics.assign(_filters.size(), FilterStatistics());
+        context.evaluationsSinceReorder = 0;
+    }
+
+    // Find the objects in each level, either from the regions the threshold algorithm reports or
+    // from its binary images. The levels are independent of each other, so this may be done by
+    // several workers at once.
+    auto &levels = context.levels;
+    if (!thresholded && _thresholdAlgorithm->regions(gray, context.regions, context.thresholdContext.get())) {
+        if (timed)
+            trace.add(STAGE_THRESHOLD, -1, 0, start, trace.elapsed());
+        context.levelCounts.assign(context.regions.size(), 1);
+        findObjects(gray, context.regions, context);
+    } else if (_runLengthLevels) {
+        _thresholdAlgorithm->runLengthImages(gray, context.runLengthImages, context.levelCounts);
+        if (timed)
+            trace.add(STAGE_THRESHOLD, -1, 0, start, trace.elapsed());
+        findObjects(gray, context.runLengthImages, context);
+    } else {
+        if (!thresholded) {
+            _thresholdAlgorithm->binaryImages(gray, context.binaryImages, context.levelCounts);
+            if (timed)
+                trace.add(STAGE_THRESHOLD, -1, 0, start, trace.elapsed());
+        }
+        if (timed) {
+            // Images may have changed places when levels were left out.
+            for (auto &binaryImage : context.binaryImages)
+                if (std::find(data.begin(), data.end(), binaryImage.data) == data.end())
+                    trace.imageAllocations++;
         }
-        copy(newCenters.begin(), newCenters.end(), back_inserter(centers));
+        findObjects(gray, context.binaryImages, context);
+    }
+    collectStatistics(context);
+    if (_adaptiveFilterOrder && context.evaluationsSinceReorder >= _filterReorderInterval)
+        updateFilterOrder(context);
+
+    // Combine the objects of all levels, in level order, to find out the number of occurrences of
+    // each object. A binary image that stands for several identical levels counts that many times.
+    if (timed)
+        start = trace.elapsed();
+    auto &grouping = context.grouping;
+    grouping.minDistBetweenObjects(_minDistBetweenObjects);
+    for (size_t i = 0; i < levels.size(); i++)
+        for (int n = 0; n < context.levelCounts[i]; n++)
+            grouping.addLevel(levels[i]);
+    auto &centers = grouping.groups();
+    if (timed) {
+        double end = trace.elapsed();
+        trace.add(STAGE_GROUPING, -1, 0, start, end);
+        start = end;
     }
 
     // Convert the centers that were found into keypoints. Omit centers with less than the specified
     // minimum number of occurrences.
     std::vector<cv::KeyPoint> keypoints;
-    for (auto &center : centers) {
-        if (center.size() < _thresholdAlgorithm->minRepeatability())
+    if (result != nullptr)
+        groupResult(centers, _thresholdAlgorithm->minRepeatability(), context.levelObjects, *result);
+    else
+        keypoints = groupKeypoints(centers, _thresholdAlgorithm->minRepeatability());
+    if (timed)
+        trace.add(STAGE_KEYPOINTS, -1, 0, start, trace.elapsed());
+    return keypoints;
+}
+
+/* ---------------------------------------------------------------------------------------------- */
+/* Calls process(i, worker) for every level (or tile) i. When more than one worker is configured, */
+/* the levels are distributed over the calling thread and the threads of the pool; worker is the  */
+/* index of the thread. Since every level has its own slot in the result, the outcome does not    */
+/* depend on which worker processed which level.                                                  */
+/* ---------------------------------------------------------------------------------------------- */
+template<typename F>
+void ObjectDetector::forEachLevel(WorkerPool &pool, size_t count, F process, bool sequential) const
+{
+    pool.run(sequential ? 1 : std::max(1u, _workers), count, process);
+}
+
+/* ---------------------------------------------------------------------------------------------- */
+/* The margin around each tile, in pixels. Unless it was set explicitly, it is derived from the   */
+/* largest object the area filter lets through (its diameter, as if it were a circle), plus the   */
+/* minimum distance between objects. Without an area filter it is a quarter of the tile size.     */
+/* ---------------------------------------------------------------------------------------------- */
+int ObjectDetector::tileHalo() const
+{
+    if (_tileHalo > 0)
+        return _tileHalo;
+    auto filter = areaFilter();
+    if (filter != nullptr)
+        return (int)std::ceil(2 * std::sqrt(filter->maxArea() / CV_PI) + _minDistBetweenObjects);
+    return _tileSize / 4;
+}
+
+/* ---------------------------------------------------------------------------------------------- */
+/* Gives the filters a new generation, which no other set of filters of any detector has had, so  */
+/* that detection contexts start over with the filter statistics and order. Comparing the filters */
+/* themselves would not do: new filters may get the addresses of filters that were removed.       */
+/* ---------------------------------------------------------------------------------------------- */
+void ObjectDetector::changeFilters()
+{
+    static std::atomic<size_t> generations(0);
+    _filterGeneration = ++generations;
+}
+
+/* ---------------------------------------------------------------------------------------------- */
+/* The first area filter, if any.                                                                 */
+/* ---------------------------------------------------------------------------------------------- */
+const AreaFilter *ObjectDetector::areaFilter() const
+{
+    for (auto &filter : _filters) {
+        auto areaFilter = dynamic_cast<const AreaFilter *>(filter.get());
+        if (areaFilter != nullptr)
+            return areaFilter;
+    }
+    return nullptr;
+}
+
+/* ---------------------------------------------------------------------------------------------- */
+/* Coarse-to-fine detection                                                                       */
+/*                                                                                                */
+/* Downsamples the image by a factor 2 for each pyramid level, and looks for candidate objects in */
+/* the downsampled image with the threshold algorithm and the area filter only, its limits scaled */
+/* to match (with some slack, since small details disappear when downsampling). Only the padded   */
+/* regions around the candidates are then processed at full resolution, by the threshold          */
+/* algorithm and all filters. Overlapping regions are merged first, so that no object is found    */
+/* twice. Objects that are cut off by the edge of a region are ignored, like those of the windows */
+/* of a StreamDetector. When the regions cover most of the image, the image is processed as a     */
+/* whole.                                                                                         */
+/*                                                                                                */
+/* Please note that threshold algorithms that look at the image as a whole (e.g. Otsu's) now look */
+/* at each region separately, and that objects that are too small to survive downsampling are     */
+/* not found.                                                                                     */
+/* ---------------------------------------------------------------------------------------------- */
+std::vector<cv::KeyPoint> ObjectDetector::detectPyramid(const cv::Mat &image, DetectionContext &context,
+                                                        DetectionResult *result) const
+{
+    assert(image.data != nullptr);
+    assert(_thresholdAlgorithm != nullptr);
+
+    cv::Mat gray;
+    if (image.channels() == 3 || image.channels() == 4) {
+        cvtColor(image, context.gray, cv::COLOR_BGR2GRAY);
+        gray = context.gray;
+    } else
+        gray = image;
+    assert(gray.type() == CV_8UC1);
+
+    int factor = 1 << _pyramidLevels;
+    if (gray.cols < factor * 8 || gray.rows < factor * 8)
+        return detectLevels(gray, context, result);
+    findRegionsOfInterest(gray, context);
+
+    double area = 0;
+    for (auto &roi : context.regionsOfInterest)
+        area += roi.area();
+    if (area > 0.5 * gray.total())
+        return detectLevels(gray, context, result);
+
+    // The regions do not overlap, so each object is found in one region at most.
+    std::vector<cv::KeyPoint> keypoints;
+    for (auto &roi : context.regionsOfInterest) {
+        if (result != nullptr) {
+            auto &objects = context.regionObjects;
+            objects.attributes = result->attributes;
+            objects.clear();
+            detectLevels(gray(roi), context, &objects);
+            size_t first = result->count();
+            for (size_t i = 0; i < objects.count(); i++)
+                if (!cutOff(objects.keypoint(i), roi, gray.size()))
+                    result->add(objects, i);
+            result->translate(first, roi.tl());
             continue;
-        cv::Point2d sumPoint(0, 0);
-        double normalizer = 0;
-        for (auto &j : center) {
-            sumPoint += j.confidence * j.location;
-            normalizer += j.confidence;
         }
-        sumPoint *= (1. / normalizer);
-        cv::KeyPoint kpt(sumPoint, (float) (center[center.size() / 2].radius) * 2.0f);
-        keypoints.push_back(kpt);
+        for (auto &keypoint : detectLevels(gray(roi), context, nullptr)) {
+            if (cutOff(keypoint, roi, gray.size()))
+                continue;
+            keypoint.pt.x += roi.x;
+            keypoint.pt.y += roi.y;
+            keypoints.push_back(keypoint);
+        }
     }
     return keypoints;
 }
 
 /* ---------------------------------------------------------------------------------------------- */
-std::vector<Center> ObjectDetector::findObjects(const cv::Mat &originalImage, const cv::Mat &binaryImage)
+/* Finds the regions of the full resolution image that may contain objects, using the downsampled */
+/* image.                                                                                         */
+/* ---------------------------------------------------------------------------------------------- */
+void ObjectDetector::findRegionsOfInterest(const cv::Mat &gray, DetectionContext &context) const
+{
+    const int factor = 1 << _pyramidLevels;
+    const double scale = 1.0 / factor;
+    cv::resize(gray, context.coarse, cv::Size(), scale, scale, cv::INTER_AREA);
+
+    // Limits of the area filter in the downsampled image. Small objects may shrink to nothing and
+    // large ones may merge with their neighbours, hence the slack.
+    double minArea = 1, maxArea = std::numeric_limits<double>::max();
+    auto filter = areaFilter();
+    if (filter != nullptr) {
+        minArea = std::max(1.0, 0.5 * filter->minArea() * scale * scale);
+        maxArea = 2.0 * filter->maxArea() * scale * scale;
+    }
+
+    // Candidates are the bounding rectangles of all regions of acceptable size, at any level.
+    std::vector<cv::Rect> candidates;
+    if (context.thresholdAlgorithm != _thresholdAlgorithm) {
+        context.thresholdAlgorithm = _thresholdAlgorithm;
+        context.thresholdAlgorithmType = typeid(*_thresholdAlgorithm);
+        context.thresholdContext = _thresholdAlgorithm->createContext();
+    }
+    if (_thresholdAlgorithm->regions(context.coarse, context.regions, context.thresholdContext.get())) {
+        for (auto &level : context.regions)
+            for (auto &region : level)
+                if (region.moments.m00 >= minArea && region.moments.m00 <= maxArea)
+                    candidates.push_back(cv::boundingRect(region.contour));
+    } else {
+        _thresholdAlgorithm->binaryImages(context.coarse, context.coarseBinaryImages, context.levelCounts);
+        std::vector<std::vector<cv::Point>> contours;
+        for (size_t i = 0; i < context.levelCounts.size(); i++) {
+            findContours(context.coarseBinaryImages[i], contours, cv::RETR_LIST, cv::CHAIN_APPROX_SIMPLE);
+            for (auto &contour : contours) {
+                double contourArea = cv::contourArea(contour);
+                if (contourArea >= minArea && contourArea <= maxArea)
+                    candidates.push_back(cv::boundingRect(contour));
+            }
+        }
+    }
+
+    // Scale the candidates to full resolution, pad them with the lost resolution and the minimum
+    // distance between objects, and merge overlapping ones.
+    int pad = 2 * factor + (int)std::ceil(_minDistBetweenObjects);
+    cv::Rect bounds(0, 0, gray.cols, gray.rows);
+    auto &rois = context.regionsOfInterest;
+    rois.clear();
+    for (auto &candidate : candidates)
+        rois.push_back(cv::Rect(candidate.x * factor - pad, candidate.y * factor - pad,
+                                candidate.width * factor + 2 * pad, candidate.height * factor + 2 * pad) & bounds);
+    mergeOverlapping(rois);
+}
+
+/* ---------------------------------------------------------------------------------------------- */
+std::vector<cv::KeyPoint> ObjectDetector::detectTiled(const cv::Mat &image) const
+{
+    assert(image.data != nullptr);
+    return detectTiled(image.size(), [&](const cv::Rect &rect, cv::Mat &tile) { tile = image(rect); });
+}
+
+/* ---------------------------------------------------------------------------------------------- */
+/* Tiled detection                                                                                */
+/*                                                                                                */
+/* Detects the objects in an image of the given size one tile at a time, so that the memory used  */
+/* depends on the tile size rather than the image size. Each tile is read together with a halo    */
+/* around it, large enough to contain any object whose center lies in the tile; of the objects    */
+/* found, a tile only keeps those centered in the tile itself. The tiles are distributed over the */
+/* workers. Finally, objects of adjacent tiles that are closer than the minimum distance between  */
+/* objects (e.g. because a threshold algorithm saw slightly different surroundings) are combined, */
+/* in the same way as the objects of different levels.                                            */
+/* ---------------------------------------------------------------------------------------------- */
+std::vector<cv::KeyPoint> ObjectDetector::detectTiled(const cv::Size &size, const TileReader &readTile) const
+{
+    assert(_thresholdAlgorithm != nullptr);
+    assert(_tileSize > 0);
+
+    int halo = tileHalo();
+    int columns = (size.width + _tileSize - 1) / _tileSize;
+    int rows = (size.height + _tileSize - 1) / _tileSize;
+    size_t tiles = (size_t)columns * rows;
+    size_t workers = std::max<size_t>(1, std::min<size_t>(_workers, tiles));
+
+    // Every worker has its own context, tile buffer and result, which are reused for all of its tiles.
+    // The results keep the confidence of each object, for combining the objects near the seams.
+    std::vector<DetectionContext> contexts(workers);
+    std::vector<cv::Mat> buffers(workers);
+    std::vector<DetectionResult> results(workers, DetectionResult(ATTRIBUTE_CONFIDENCE));
+    WorkerPool pool;
+    for (auto &context : contexts)
+        context.sequentialLevels = true;
+
+    std::vector<std::vector<Center>> found(tiles);
+    cv::Rect bounds(0, 0, size.width, size.height);
+    forEachLevel(pool, tiles, [&](size_t i, size_t w) {
+        cv::Rect core((int)(i % columns) * _tileSize, (int)(i / columns) * _tileSize, _tileSize, _tileSize);
+        core &= bounds;
+        cv::Rect rect(core.x - halo, core.y - halo, core.width + 2 * halo, core.height + 2 * halo);
+        rect &= bounds;
+        readTile(rect, buffers[w]);
+        assert(buffers[w].cols == rect.width && buffers[w].rows == rect.height);
+
+        auto &result = results[w];
+        detect(buffers[w], result, contexts[w]);
+        for (size_t j = 0; j < result.count(); j++) {
+            cv::Point2d location(result.x[j] + rect.x, result.y[j] + rect.y);
+            if (location.x >= core.x && location.x < core.x + core.width &&
+                location.y >= core.y && location.y < core.y + core.height)
+                found[i].push_back(Center{location, result.size[j] / 2.0, result.confidence[j]});
+        }
+    });
+
+    // Combine the objects near the seams, in tile order, in the same way as the objects of the levels
+    // of a single image.
+    CenterGrouping grouping(_minDistBetweenObjects);
+    for (auto &centers : found)
+        grouping.addLevel(centers);
+    return groupKeypoints(grouping.groups(), 1);
+}
+
+/* ---------------------------------------------------------------------------------------------- */
+void ObjectDetector::findObjects(const cv::Mat &originalImage, const std::vector<cv::Mat> &binaryImages,
+                                 DetectionContext &context) const
+{
+    // Only the first binary images are valid; see ThresholdAlgorithm::binaryImages().
+    size_t count = context.levelCounts.size();
+    prepareLevels(count, context);
+    forEachLevel(context.workerPool, count, [&](size_t i, size_t worker) {
+        context.levelStatistics[i].thread = std::this_thread::get_id();
+        findObjects(originalImage, binaryImages[i], context.filterOrder, context.scratch[worker],
+                    context.levelStatistics[i], context.levels[i], context.objects(i));
+    }, context.sequentialLevels);
+}
+
+/* ---------------------------------------------------------------------------------------------- */
+void ObjectDetector::findObjects(const cv::Mat &originalImage, const std::vector<std::vector<Region>> &regions,
+                                 DetectionContext &context) const
+{
+    prepareLevels(regions.size(), context);
+    forEachLevel(context.workerPool, regions.size(), [&](size_t i, size_t worker) {
+        context.levelStatistics[i].thread = std::this_thread::get_id();
+        findObjects(originalImage, regions[i], context.filterOrder, context.scratch[worker], context.levelStatistics[i],
+                    context.levels[i], context.objects(i));
+    }, context.sequentialLevels);
+}
+
+/* ---------------------------------------------------------------------------------------------- */
+/* Each level is labeled in its run-length encoded form, without decoding it (see                 */
+/* RunLengthLabeler), and its regions are processed like those a threshold algorithm reports. The */
+/* objects are therefore the same as those of the component tree algorithm with the same levels.  */
+/* Like with connectedComponents(), the contours are only traced when they are needed.            */
+/* ---------------------------------------------------------------------------------------------- */
+void ObjectDetector::findObjects(const cv::Mat &originalImage, const std::vector<RunLengthImage> &levels,
+                                 DetectionContext &context) const
+{
+    auto needsContour = [](const std::shared_ptr<Filter> &filter) { return filter->needsContour(); };
+    bool contours = !_connectedComponents || (context.attributes & (CONTOUR_ATTRIBUTES | ATTRIBUTE_BOUNDS)) != 0 ||
+                    std::any_of(_filters.begin(), _filters.end(), needsContour);
+    prepareLevels(levels.size(), context);
+    forEachLevel(context.workerPool, levels.size(), [&](size_t i, size_t worker) {
+        auto &statistics = context.levelStatistics[i];
+        auto &scratch = context.scratch[worker];
+        statistics.thread = std::this_thread::get_id();
+        double start = _instrumentation ? traceTime(statistics.origin) : 0;
+        scratch.labeler.regions(levels[i], contours, scratch.regions);
+        if (_instrumentation)
+            statistics.events.push_back(TraceEvent{STAGE_FIND_CONTOURS, statistics.level, 0, start,
+                                                   traceTime(statistics.origin) - start});
+        findObjects(originalImage, scratch.regions, context.filterOrder, scratch, statistics, context.levels[i],
+                    context.objects(i));
+    }, context.sequentialLevels);
+}
+
+/* ---------------------------------------------------------------------------------------------- */
+void ObjectDetector::findObjects(const cv::Mat &originalImage, const cv::Mat &binaryImage,
+                                 const std::vector<size_t> &filterOrder, LevelScratch &scratch,
+                                 LevelStatistics &statistics, std::vector<Center> &centers,
+                                 DetectionResult *objects) const
 {
     assert(originalImage.data != nullptr);
 
-    std::vector<Center> centers;
+    // When asked for, and neither the filters nor the attributes asked for need the shape of the
+    // objects, labeling the connected components is enough, and cheaper than tracing their contours.
+    auto needsContour = [](const std::shared_ptr<Filter> &filter) { return filter->needsContour(); };
+    if (_connectedComponents && (objects == nullptr || (objects->attributes & CONTOUR_ATTRIBUTES) == 0) &&
+        std::none_of(_filters.begin(), _filters.end(), needsContour)) {
+        findComponents(originalImage, binaryImage, filterOrder, scratch, statistics, centers, objects);
+        return;
+    }
+
+    bool timed = _instrumentation;
+    double start = timed ? traceTime(statistics.origin) : 0;
+
+    centers.clear();
 
     // Find contours in the binary image using the findContours()-function. Let this function
-    // return a list of contours only (no hierarchical data).
-    std::vector <std::vector<cv::Point>> contours;
+    // return a list of contours only (no hierarchical data). The contours of the previous level
+    // are overwritten, which keeps their memory.
+    auto &contours = scratch.contours;
     findContours(binaryImage, contours, cv::RETR_LIST, cv::CHAIN_APPROX_SIMPLE);
+    statistics.contours = contours.size();
+    if (timed) {
+        statistics.contourStart = traceTime(statistics.origin);
+        statistics.events.push_back(TraceEvent{STAGE_FIND_CONTOURS, statistics.level, 0, start,
+                                               statistics.contourStart - start});
+    }
 
-    // Now process all the contours that were found.
+    // Now process all the contours that were found, either all at once or one at a time.
+    LevelFeatures level;
+    if (_batchFilters) {
+        auto &batch = scratch.batch;
+        batch.clear();
+        batch.counters = &statistics.features;
+        if (timed)
+            start = traceTime(statistics.origin);
+        for (auto &contour : contours)
+            batch.add(contour, moments(cv::Mat(contour), true));
+        if (timed)
+            statistics.seconds[STAGE_MOMENTS] += traceTime(statistics.origin) - start;
+        acceptObjects(originalImage, binaryImage, &level, filterOrder, scratch, statistics, centers, objects);
+        statistics.objects = centers.size();
+        return;
+    }
     for (auto &contour : contours) {
         Center center;
         center.confidence = 1;
+        if (timed)
+            start = traceTime(statistics.origin);
         cv::Moments m = moments(cv::Mat(contour), true); // 2nd parameter specifies image is binary.
+        if (timed)
+            statistics.seconds[STAGE_MOMENTS] += traceTime(statistics.origin) - start;
 
         // Skip contours that have no area.
         if (m.m00 == 0.0)
             continue;
 
-        // Process all filters until the first one that filters out the contour.
-        bool filtered = false;
-        for (const auto &f : _filters)
-            if (filtered = f->filter(originalImage, binaryImage, contour, center, m))
-                break;
-        if (filtered)
+        ContourFeatures features(originalImage, binaryImage, contour, m, &level, &statistics.features);
+        if (acceptObject(features, filterOrder, scratch, statistics, center, objects))
+            centers.push_back(center);
+    }
+    statistics.objects = centers.size();
+}
+
+/* ---------------------------------------------------------------------------------------------- */
+/* Finds the objects in a binary image by labeling its (8-connected) components in a single scan, */
+/* for filters that only need the area and centroid, when connectedComponents() is switched on.   */
+/* The area is the number of pixels, which is slightly larger than the area enclosed by the       */
+/* contour, and the radius that of a disk of the same area rather than the median distance to the */
+/* contour. Holes in objects are not reported as objects of their own, unlike with contours. The  */
+/* keypoints therefore differ from those found by tracing contours.                               */
+/* ---------------------------------------------------------------------------------------------- */
+void ObjectDetector::findComponents(const cv::Mat &originalImage, const cv::Mat &binaryImage,
+                                    const std::vector<size_t> &filterOrder, LevelScratch &scratch,
+                                    LevelStatistics &statistics, std::vector<Center> &centers,
+                                    DetectionResult *objects) const
+{
+    bool timed = _instrumentation;
+    double start = timed ? traceTime(statistics.origin) : 0;
+
+    auto &labels = scratch.labels, &stats = scratch.stats, &centroids = scratch.centroids;
+    int count = cv::connectedComponentsWithStats(binaryImage, labels, stats, centroids, 8, CV_32S);
+    statistics.contours = (size_t)count - 1;
+    if (timed) {
+        statistics.contourStart = traceTime(statistics.origin);
+        statistics.events.push_back(TraceEvent{STAGE_FIND_CONTOURS, statistics.level, 0, start,
+                                               statistics.contourStart - start});
+    }
+
+    // Label 0 is the background.
+    centers.clear();
+    const std::vector<cv::Point> noContour;
+    LevelFeatures level;
+    for (int i = 1; i < count; i++) {
+        cv::Moments m;
+        m.m00 = stats.at<int>(i, cv::CC_STAT_AREA);
+        m.m10 = centroids.at<double>(i, 0) * m.m00;
+        m.m01 = centroids.at<double>(i, 1) * m.m00;
+        Center center;
+        center.confidence = 1;
+        ContourFeatures features(originalImage, binaryImage, noContour, m, &level, &statistics.features);
+        if (!acceptObject(features, filterOrder, scratch, statistics, center, objects))
+            continue;
+        centers.push_back(center);
+        // Without a contour, the bounds come from the labeling instead.
+        if (objects != nullptr && objects->has(ATTRIBUTE_BOUNDS))
+            objects->bounds.back() = cv::Rect(stats.at<int>(i, cv::CC_STAT_LEFT), stats.at<int>(i, cv::CC_STAT_TOP),
+                                              stats.at<int>(i, cv::CC_STAT_WIDTH),
+                                              stats.at<int>(i, cv::CC_STAT_HEIGHT));
+    }
+    statistics.objects = centers.size();
+}
+
+/* ---------------------------------------------------------------------------------------------- */
+/* Same as findObjects() for a binary image, for threshold algorithms that report the regions of  */
+/* a level themselves. Since there is no binary image, the filters receive an empty one.          */
+/* ---------------------------------------------------------------------------------------------- */
+void ObjectDetector::findObjects(const cv::Mat &originalImage, const std::vector<Region> &regions,
+                                 const std::vector<size_t> &filterOrder, LevelScratch &scratch,
+                                 LevelStatistics &statistics, std::vector<Center> &centers,
+                                 DetectionResult *objects) const
+{
+    assert(originalImage.data != nullptr);
+    statistics.contours = regions.size();
+    if (_instrumentation)
+        statistics.contourStart = traceTime(statistics.origin);
+
+    centers.clear();
+    cv::Mat noBinaryImage;
+    if (_batchFilters) {
+        auto &batch = scratch.batch;
+        batch.clear();
+        batch.counters = &statistics.features;
+        for (auto &region : regions)
+            batch.add(region.contour, region.moments);
+        acceptObjects(originalImage, noBinaryImage, nullptr, filterOrder, scratch, statistics, centers, objects);
+        statistics.objects = centers.size();
+        return;
+    }
+    for (auto &region : regions) {
+        Center center;
+        center.confidence = 1;
+        if (region.moments.m00 == 0.0)
+            continue;
+        ContourFeatures features(originalImage, noBinaryImage, region.contour, region.moments, nullptr,
+                                 &statistics.features);
+        if (acceptObject(features, filterOrder, scratch, statistics, center, objects))
+            centers.push_back(center);
+    }
+    statistics.objects = centers.size();
+}
+
+/* ---------------------------------------------------------------------------------------------- */
+/* Applies the filters to one contour, starting with the confidence in center. When it passes all */
+/* of them, its location and radius are stored in center, it is added to objects (when given) and */
+/* true is returned.                                                                              */
+/* ---------------------------------------------------------------------------------------------- */
+bool ObjectDetector::acceptObject(const ContourFeatures &features, const std::vector<size_t> &filterOrder,
+                                  LevelScratch &scratch, LevelStatistics &statistics, Center &center,
+                                  DetectionResult *objects) const
+{
+    bool timed = _instrumentation;
+    double start = timed ? traceTime(statistics.origin) : 0;
+
+    // Process all filters until the first one that filters out the contour. Since a contour must
+    // pass every filter, the order does not change the outcome.
+    for (auto f : filterOrder) {
+        auto &s = statistics.filters[f];
+        s.evaluations++;
+        bool filtered;
+        if (_adaptiveFilterOrder) {
+            auto start = std::chrono::steady_clock::now();
+            filtered = _filters[f]->filter(features, center);
+            s.seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        } else
+            filtered = _filters[f]->filter(features, center);
+        if (filtered) {
+            s.rejections++;
+            if (timed)
+                statistics.seconds[STAGE_FILTERS] += traceTime(statistics.origin) - start;
+            return false;
+        }
+    }
+    if (timed) {
+        double end = traceTime(statistics.origin);
+        statistics.seconds[STAGE_FILTERS] += end - start;
+        start = end;
+    }
+
+    // By the time we reach here, the current contour apparently hasn't been filtered out,
+    // so compute the location and blob radius and store it in the center.
+    if (_floatRadius)
+        locateObject(features, center, scratch.floatDistances);
+    else
+        locateObject(features, center, scratch.distances);
+    if (objects != nullptr)
+        recordObject(features, statistics.level, center, *objects);
+    if (timed)
+        statistics.seconds[STAGE_RADIUS] += traceTime(statistics.origin) - start;
+    return true;
+}
+
+/* ---------------------------------------------------------------------------------------------- */
+/* Applies the filters to a batch of contours. Filters that support batches are applied to all    */
+/* contours at once, in the current filter order; the other filters are then applied to each      */
+/* remaining contour separately. The contours that pass all filters are added to centers.         */
+/* ---------------------------------------------------------------------------------------------- */
+void ObjectDetector::acceptObjects(const cv::Mat &originalImage, const cv::Mat &binaryImage, LevelFeatures *level,
+                                   const std::vector<size_t> &filterOrder, LevelScratch &scratch,
+                                   LevelStatistics &statistics, std::vector<Center> &centers,
+                                   DetectionResult *objects) const
+{
+    auto &batch = scratch.batch;
+    bool timed = _instrumentation;
+    double start = timed ? traceTime(statistics.origin) : 0;
+
+    std::vector<size_t> remaining;
+    size_t alive = batch.count();
+    for (auto f : filterOrder) {
+        auto &s = statistics.filters[f];
+        std::chrono::steady_clock::time_point filterStart;
+        if (_adaptiveFilterOrder)
+            filterStart = std::chrono::steady_clock::now();
+        if (!_filters[f]->filterBatch(batch)) {
+            remaining.push_back(f);
+            continue;
+        }
+        // The time of the batch is spread over the contours it evaluated, like that of filter() over
+        // single contours, so that both rank the same in the adaptive filter order.
+        if (_adaptiveFilterOrder)
+            s.seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - filterStart).count();
+        size_t passed = batch.count();
+        s.evaluations += alive;
+        s.rejections += alive - passed;
+        alive = passed;
+    }
+    if (timed)
+        statistics.seconds[STAGE_FILTERS] += traceTime(statistics.origin) - start;
+
+    for (size_t i = 0; i < batch.size(); i++) {
+        if (!batch.alive[i])
+            continue;
+        Center center;
+        center.confidence = batch.confidence[i];
+        ContourFeatures features(originalImage, binaryImage, *batch.contours[i], batch.moments[i], level,
+                                 &statistics.features);
+        if (acceptObject(features, remaining, scratch, statistics, center, objects))
+            centers.push_back(center);
+    }
+}
+
+/* ---------------------------------------------------------------------------------------------- */
+/* Starts the counters and the trace of a call to detect() over. In pyramid mode, the levels of   */
+/* all regions of interest add to them.                                                           */
+/* ---------------------------------------------------------------------------------------------- */
+void ObjectDetector::beginDetection(DetectionContext &context) const
+{
+    context.featureCounters.clear();
+    if (_instrumentation)
+        context.trace.clear();
+}
+
+/* ---------------------------------------------------------------------------------------------- */
+/* Prepares the per-level results and statistics for the given number of levels.                  */
+/* ---------------------------------------------------------------------------------------------- */
+void ObjectDetector::prepareLevels(size_t count, DetectionContext &context) const
+{
+    context.levels.resize(count);
+    context.levelStatistics.resize(count);
+    if ((context.attributes & LEVEL_ATTRIBUTES) != 0) {
+        context.levelObjects.resize(count);
+        for (auto &objects : context.levelObjects) {
+            objects.attributes = context.attributes & LEVEL_ATTRIBUTES;
+            objects.clear();
+        }
+    }
+    context.scratch.resize(std::max(1u, _workers));
+    for (size_t i = 0; i < count; i++) {
+        // Start over, but keep the memory of the vectors.
+        auto &statistics = context.levelStatistics[i];
+        auto filters = std::move(statistics.filters);
+        auto events = std::move(statistics.events);
+        statistics = LevelStatistics();
+        statistics.level = (int)i;
+        statistics.filters = std::move(filters);
+        statistics.filters.assign(_filters.size(), FilterStatistics());
+        statistics.events = std::move(events);
+        statistics.events.clear();
+        statistics.origin = context.trace.origin;
+        statistics.thread = std::this_thread::get_id();
+    }
+}
+
+/* ---------------------------------------------------------------------------------------------- */
+/* Adds the statistics of all levels to the context, and to its trace when instrumentation is     */
+/* switched on. Threads are numbered in the order in which they first appear; 0 is the caller.    */
+/* ---------------------------------------------------------------------------------------------- */
+void ObjectDetector::collectStatistics(DetectionContext &context) const
+{
+    auto &trace = context.trace;
+    std::vector<std::thread::id> threads(1, std::this_thread::get_id());
+    if (_instrumentation && trace.filters.size() != _filters.size())
+        trace.filters.assign(_filters.size(), FilterStatistics());
+
+    for (auto &statistics : context.levelStatistics) {
+        context.featureCounters += statistics.features;
+        for (size_t f = 0; f < statistics.filters.size(); f++) {
+            context.filterStatistics[f] += statistics.filters[f];
+            context.evaluationsSinceReorder += statistics.filters[f].evaluations;
+        }
+        if (!_instrumentation)
             continue;
 
-        // By the time we reach here, the current contour apparently hasn't been filtered out,
-        // so compute the location and blob radius and store it as a Center in the centers vector.
-        center.location = cv::Point2d(m.m10 / m.m00, m.m01 / m.m00);
-        std::vector<double> dists;
-        for (const auto &pointIdx : contour) {
-            cv::Point2d pt = pointIdx;
-            dists.push_back(norm(center.location - pt));
+        for (size_t f = 0; f < statistics.filters.size(); f++)
+            trace.filters[f] += statistics.filters[f];
+        trace.contours.push_back(statistics.contours);
+        trace.objects.push_back(statistics.objects);
+
+        auto thread = std::find(threads.begin(), threads.end(), statistics.thread) - threads.begin();
+        if (thread == (long)threads.size())
+            threads.push_back(statistics.thread);
+        for (auto &e : statistics.events)
+            trace.add(e.stage, e.level, (int)thread, e.start, e.start + e.duration);
+        double start = statistics.contourStart;
+        for (auto stage : {STAGE_MOMENTS, STAGE_FILTERS, STAGE_RADIUS}) {
+            trace.add(stage, statistics.level, (int)thread, start, start + statistics.seconds[stage]);
+            start += statistics.seconds[stage];
         }
-        sort(dists.begin(), dists.end());
-        center.radius = (dists[(dists.size() - 1) / 2] + dists[dists.size() / 2]) / 2.;
-        centers.push_back(center);
     }
-    return centers;
+}
+
+/* ---------------------------------------------------------------------------------------------- */
+/* Orders the filters by their expected cost per contour. Evaluating a filter with cost c that    */
+/* filters out a fraction p of the contours saves the cost of all filters after it for that       */
+/* fraction, so the expected total cost is lowest when the filters are sorted by c / p.           */
+/* ---------------------------------------------------------------------------------------------- */
+void ObjectDetector::updateFilterOrder(DetectionContext &context) const
+{
+    auto &s = context.filterStatistics;
+    auto rank = [&](size_t f) {
+        double p = s[f].rejectionRate();
+        return p > 0 ? s[f].secondsPerEvaluation() / p : std::numeric_limits<double>::infinity();
+    };
+    std::stable_sort(context.filterOrder.begin(), context.filterOrder.end(),
+                     [&](size_t a, size_t b) { return rank(a) < rank(b); });
+    context.evaluationsSinceReorder = 0;
+}
+
+/* ---------------------------------------------------------------------------------------------- */
+/* Reads a setting of the detector into value, unless the node has no such setting. Settings are  */
+/* stored as integers, also flags and counts.                                                     */
+/* ---------------------------------------------------------------------------------------------- */
+template<typename T>
+inline void readSetting(const cv::FileNode &node, const char *name, T &value)
+{
+    auto setting = node[name];
+    if (!setting.empty())
+        value = (T)(int)setting;
 }
 
 void ObjectDetector::read(const cv::FileNode &node) {
@@ -184,6 +1237,19 @@ void ObjectDetector::read(const cv::FileNode &node) {
     // Minimum distance between Objects
     _minDistBetweenObjects = (double)node[NODE_MIN_DIST_BETWEEN_OBJECTS];
 
+    // Settings; those that are missing keep their current values.
+    readSetting(node, NODE_WORKERS, _workers);
+    readSetting(node, NODE_ADAPTIVE_FILTER_ORDER, _adaptiveFilterOrder);
+    readSetting(node, NODE_FILTER_REORDER_INTERVAL, _filterReorderInterval);
+    readSetting(node, NODE_BATCH_FILTERS, _batchFilters);
+    readSetting(node, NODE_FLOAT_RADIUS, _floatRadius);
+    readSetting(node, NODE_RUN_LENGTH_LEVELS, _runLengthLevels);
+    readSetting(node, NODE_CONNECTED_COMPONENTS, _connectedComponents);
+    readSetting(node, NODE_INSTRUMENTATION, _instrumentation);
+    readSetting(node, NODE_PYRAMID_LEVELS, _pyramidLevels);
+    readSetting(node, NODE_TILE_SIZE, _tileSize);
+    readSetting(node, NODE_TILE_HALO, _tileHalo);
+
     // Filters
     auto f = node[NODE_FILTERS];
     for (auto fi = f.begin(); fi != f.end(); fi++)
@@ -204,6 +1270,17 @@ void ObjectDetector::write(cv::FileStorage &storage) const {
     storage << "}";
 
     storage << NODE_MIN_DIST_BETWEEN_OBJECTS << _minDistBetweenObjects;
+    storage << NODE_WORKERS << (int)_workers;
+    storage << NODE_ADAPTIVE_FILTER_ORDER << (int)_adaptiveFilterOrder;
+    storage << NODE_FILTER_REORDER_INTERVAL << (int)_filterReorderInterval;
+    storage << NODE_BATCH_FILTERS << (int)_batchFilters;
+    storage << NODE_FLOAT_RADIUS << (int)_floatRadius;
+    storage << NODE_RUN_LENGTH_LEVELS << (int)_runLengthLevels;
+    storage << NODE_CONNECTED_COMPONENTS << (int)_connectedComponents;
+    storage << NODE_INSTRUMENTATION << (int)_instrumentation;
+    storage << NODE_PYRAMID_LEVELS << _pyramidLevels;
+    storage << NODE_TILE_SIZE << _tileSize;
+    storage << NODE_TILE_HALO << _tileHalo;
 
     storage << NODE_FILTERS << "{";
     //TODO: filters
@@ -14,6 +14,7 @@
 #define NODE_MAX                        "max"
 #define NODE_STEP                       "step"
 #define NODE_MIN_REPEATABLILITY         "minRepeatability"
+#define NODE_LEVEL_TOLERANCE            "levelTolerance"
 
 /*! Structural nodes
  *
@@ -27,6 +28,29 @@
 #define THRESHOLD_ALGORITHM_FIXED       "Fixed"
 #define THRESHOLD_ALGORITHM_OTSU        "Otsu"
 #define THRESHOLD_ALGORITHM_RANGE       "Range"
+#define THRESHOLD_ALGORITHM_COMPONENT_TREE "ComponentTree"
+#define THRESHOLD_ALGORITHM_ADAPTIVE    "Adaptive"
+#define NODE_BLOCK_SIZE                 "blockSize"
+#define NODE_METHOD                     "method"
+#define NODE_DELTA                      "delta"
+#define NODE_K                          "k"
+#define ADAPTIVE_METHOD_MEAN            "Mean"
+#define ADAPTIVE_METHOD_SAUVOLA         "Sauvola"
 #define NODE_MIN_DIST_BETWEEN_OBJECTS   "minDistBetweenObjects"
 
+/*! Detector settings
+ *
+ */
+#define NODE_WORKERS                    "workers"
+#define NODE_ADAPTIVE_FILTER_ORDER      "adaptiveFilterOrder"
+#define NODE_FILTER_REORDER_INTERVAL    "filterReorderInterval"
+#define NODE_BATCH_FILTERS              "batchFilters"
+#define NODE_FLOAT_RADIUS               "floatRadius"
+#define NODE_RUN_LENGTH_LEVELS          "runLengthLevels"
+#define NODE_CONNECTED_COMPONENTS       "connectedComponents"
+#define NODE_INSTRUMENTATION            "instrumentation"
+#define NODE_PYRAMID_LEVELS             "pyramidLevels"
+#define NODE_TILE_SIZE                  "tileSize"
+#define NODE_TILE_HALO                  "tileHalo"
+
 #endif //OBJECTDETECTOR_PERSISTENCE_HPP
@@ -0,0 +1,111 @@
+/* ============================================================================================== */
+/* RunLengthImage.hpp                                                                             */
+/*                                                                                                */
+/* This file is part of ObjectDetector (github.com/joostvanstuijvenberg/ObjectDetector.git)       */
+/*                                                                                                */
+/* Joost van Stuijvenberg                                                                         */
+/* ============================================================================================== */
+
+#ifndef OBJECTDETECTOR_RUNLENGTHIMAGE_HPP
+#define OBJECTDETECTOR_RUNLENGTHIMAGE_HPP
+
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#include "opencv2/opencv.hpp"
+
+/* ---------------------------------------------------------------------------------------------- */
+/* A horizontal run of set pixels, from column begin up to (but not including) column end.        */
+/* ---------------------------------------------------------------------------------------------- */
+struct Run
+{
+    int begin;
+    int end;
+};
+
+/* ---------------------------------------------------------------------------------------------- */
+/* Run-length encoded binary image                                                                */
+/*                                                                                                */
+/* Stores a binary image as the runs of set pixels of each row, which takes a fraction of the     */
+/* memory of an 8-bit image when the objects are not too ragged: 8 bytes per run plus 4 bytes per */
+/* row. The buffers are kept when the image is filled again, so that no memory needs to be        */
+/* allocated once they have grown large enough.                                                   */
+/* ---------------------------------------------------------------------------------------------- */
+class RunLengthImage {
+public:
+    inline int rows() const { return (int)_rowStart.size() - 1; }
+    inline int cols() const { return _cols; }
+    inline cv::Size size() const { return cv::Size(_cols, rows()); }
+    inline size_t runCount() const { return _runs.size(); }
+    inline const Run *rowBegin(int y) const { return _runs.data() + _rowStart[y]; }
+    inline const Run *rowEnd(int y) const { return _runs.data() + _rowStart[y + 1]; }
+    inline size_t bytes() const { return _runs.size() * sizeof(Run) + _rowStart.size() * sizeof(uint32_t); }
+    inline void reset(int cols);
+    inline void addRow(const uchar *pixels, int threshold);
+    inline void threshold(const cv::Mat &image, int threshold);
+    inline void encode(const cv::Mat &binaryImage) { threshold(binaryImage, 0); }
+    inline void decode(cv::Mat &binaryImage) const;
+private:
+    int _cols = 0;
+    // The runs of row y are _runs[_rowStart[y]] up to _runs[_rowStart[y + 1]].
+    std::vector<uint32_t> _rowStart = std::vector<uint32_t>(1, 0);
+    std::vector<Run> _runs;
+};
+
+/* ---------------------------------------------------------------------------------------------- */
+/* Empties the image, to be filled with rows of the given width by addRow().                      */
+/* ---------------------------------------------------------------------------------------------- */
+void RunLengthImage::reset(int cols)
+{
+    _cols = cols;
+    _rowStart.assign(1, 0);
+    _runs.clear();
+}
+
+/* ---------------------------------------------------------------------------------------------- */
+/* Appends a row in which the pixels above the threshold are set.                                 */
+/* ---------------------------------------------------------------------------------------------- */
+void RunLengthImage::addRow(const uchar *pixels, int threshold)
+{
+    for (int x = 0; x < _cols;) {
+        while (x < _cols && pixels[x] <= threshold)
+            x++;
+        if (x == _cols)
+            break;
+        int begin = x;
+        while (x < _cols && pixels[x] > threshold)
+            x++;
+        _runs.push_back(Run{begin, x});
+    }
+    _rowStart.push_back((uint32_t)_runs.size());
+}
+
+/* ---------------------------------------------------------------------------------------------- */
+/* Fills the image with the pixels of the grayscale image that are above the threshold, like      */
+/* cv::threshold() with THRESH_BINARY.                                                            */
+/* ---------------------------------------------------------------------------------------------- */
+void RunLengthImage::threshold(const cv::Mat &image, int threshold)
+{
+    assert(image.type() == CV_8UC1);
+    reset(image.cols);
+    for (int y = 0; y < image.rows; y++)
+        addRow(image.ptr<uchar>(y), threshold);
+}
+
+/* ---------------------------------------------------------------------------------------------- */
+/* Writes the image as an 8-bit binary image (0 or 255), reusing its data when it has the right   */
+/* size already.                                                                                  */
+/* ---------------------------------------------------------------------------------------------- */
+void RunLengthImage::decode(cv::Mat &binaryImage) const
+{
+    binaryImage.create(size(), CV_8UC1);
+    for (int y = 0; y < rows(); y++) {
+        auto row = binaryImage.ptr<uchar>(y);
+        std::memset(row, 0, (size_t)_cols);
+        for (auto run = rowBegin(y); run != rowEnd(y); run++)
+            std::memset(row + run->begin, 255, (size_t)(run->end - run->begin));
+    }
+}
+
+#endif //OBJECTDETECTOR_RUNLENGTHIMAGE_HPP
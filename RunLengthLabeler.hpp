@@ -0,0 +1,142 @@
+/* ============================================================================================== */
+/* RunLengthLabeler.hpp                                                                           */
+/*                                                                                                */
+/* This file is part of ObjectDetector (github.com/joostvanstuijvenberg/ObjectDetector.git)       */
+/*                                                                                                */
+/* Joost van Stuijvenberg                                                                         */
+/* ============================================================================================== */
+
+#ifndef OBJECTDETECTOR_RUNLENGTHLABELER_HPP
+#define OBJECTDETECTOR_RUNLENGTHLABELER_HPP
+
+#include <algorithm>
+#include <numeric>
+#include <vector>
+
+#include "opencv2/opencv.hpp"
+
+#include "RunLengthImage.hpp"
+#include "ThresholdAlgorithm.hpp"
+
+/* ---------------------------------------------------------------------------------------------- */
+/* Run-length labeler                                                                             */
+/*                                                                                                */
+/* Finds the (8-connected) regions of a run-length encoded binary image without decoding it. The  */
+/* runs of each row are merged with the runs of the row above that touch them, using union-find   */
+/* over the runs; the moments of each region are summed per run, in closed form, and its outer    */
+/* contour is traced along the runs. The regions are the same as those the component tree reports */
+/* for the same level (pixel moments, and holes are not reported as regions of their own), in the */
+/* raster order of their first pixels. The buffers are kept between calls.                        */
+/* ---------------------------------------------------------------------------------------------- */
+class RunLengthLabeler {
+public:
+    inline void regions(const RunLengthImage &image, bool contours, std::vector<Region> &regions);
+private:
+    // Raw moments (up to the third order) and the first pixel of a region.
+    struct Sums {
+        double m00, m10, m01, m20, m11, m02, m30, m21, m12, m03;
+        cv::Point seed;
+    };
+    // For each run: its parent in the union-find forest, and the region of the runs that are roots.
+    std::vector<int> _parent;
+    std::vector<int> _region;
+    std::vector<Sums> _sums;
+    std::vector<cv::Point> _border;
+    inline int find(int run);
+    inline void merge(int a, int b);
+};
+
+/* ---------------------------------------------------------------------------------------------- */
+int RunLengthLabeler::find(int run)
+{
+    while (_parent[run] != run) {
+        _parent[run] = _parent[_parent[run]];
+        run = _parent[run];
+    }
+    return run;
+}
+
+/* ---------------------------------------------------------------------------------------------- */
+/* Merges the regions of two runs. The root of a region is its first run, so that its first pixel */
+/* is known without looking at the others.                                                        */
+/* ---------------------------------------------------------------------------------------------- */
+void RunLengthLabeler::merge(int a, int b)
+{
+    a = find(a);
+    b = find(b);
+    if (a < b)
+        _parent[b] = a;
+    else if (b < a)
+        _parent[a] = b;
+}
+
+/* ---------------------------------------------------------------------------------------------- */
+/* Fills regions with the regions of the image. Without contours, only the moments are filled,    */
+/* which is enough when neither the filters nor the attributes need the shape of the objects.     */
+/* ---------------------------------------------------------------------------------------------- */
+void RunLengthLabeler::regions(const RunLengthImage &image, bool contours, std::vector<Region> &regions)
+{
+    const Run *first = image.rowBegin(0);
+    _parent.resize(image.runCount());
+    std::iota(_parent.begin(), _parent.end(), 0);
+
+    // Runs of adjacent rows touch when they overlap, or meet diagonally. Both rows are sorted, so the
+    // runs above that end too far left for one run do so for the next runs of its row as well.
+    for (int y = 1; y < image.rows(); y++) {
+        const Run *above = image.rowBegin(y - 1), *aboveEnd = image.rowEnd(y - 1);
+        for (const Run *run = image.rowBegin(y); run != image.rowEnd(y); run++) {
+            while (above != aboveEnd && above->end < run->begin)
+                above++;
+            for (const Run *a = above; a != aboveEnd && a->begin <= run->end; a++)
+                merge((int)(run - first), (int)(a - first));
+        }
+    }
+
+    // Sum the moments of the runs of each region. The sums of x, x^2 and x^3 over a run follow from
+    // those over 0 up to its begin and end.
+    auto sum1 = [](double n) { return n * (n - 1) / 2; };
+    auto sum2 = [](double n) { return n * (n - 1) * (2 * n - 1) / 6; };
+    auto sum3 = [&](double n) { return sum1(n) * sum1(n); };
+    _region.resize(image.runCount());
+    size_t count = 0;
+    for (int y = 0; y < image.rows(); y++) {
+        double y1 = y, y2 = y1 * y1, y3 = y2 * y1;
+        for (const Run *run = image.rowBegin(y); run != image.rowEnd(y); run++) {
+            int i = (int)(run - first), root = find(i);
+            if (root == i) {
+                _region[i] = (int)count++;
+                if (_sums.size() < count)
+                    _sums.emplace_back();
+                _sums[_region[i]] = Sums{0, 0, 0, 0, 0, 0, 0, 0, 0, 0, cv::Point(run->begin, y)};
+            }
+            auto &s = _sums[_region[root]];
+            double n = run->end - run->begin;
+            double x1 = sum1(run->end) - sum1(run->begin);
+            double x2 = sum2(run->end) - sum2(run->begin);
+            double x3 = sum3(run->end) - sum3(run->begin);
+            s.m00 += n; s.m10 += x1; s.m01 += n * y1;
+            s.m20 += x2; s.m11 += x1 * y1; s.m02 += n * y2;
+            s.m30 += x3; s.m21 += x2 * y1; s.m12 += x1 * y2; s.m03 += n * y3;
+        }
+    }
+
+    // A pixel is set when the first run of its row that ends right of it starts at or left of it.
+    auto inside = [&](int x, int y) {
+        if (x < 0 || y < 0 || x >= image.cols() || y >= image.rows())
+            return false;
+        auto end = image.rowEnd(y);
+        auto run = std::upper_bound(image.rowBegin(y), end, x, [](int x, const Run &run) { return x < run.end; });
+        return run != end && run->begin <= x;
+    };
+    regions.resize(count);
+    for (size_t r = 0; r < count; r++) {
+        auto &s = _sums[r];
+        regions[r].moments = cv::Moments(s.m00, s.m10, s.m01, s.m20, s.m11, s.m02, s.m30, s.m21, s.m12, s.m03);
+        if (contours)
+            traceBorder(s.seed, inside, _border, regions[r].contour);
+        else
+            regions[r].contour.clear();
+    }
+}
+
+#endif //OBJECTDETECTOR_RUNLENGTHLABELER_HPP
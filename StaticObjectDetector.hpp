@@ -0,0 +1,156 @@
+/* ============================================================================================== */
+/* StaticObjectDetector.hpp                                                                       */
+/*                                                                                                */
+/* This file is part of ObjectDetector (github.com/joostvanstuijvenberg/ObjectDetector.git)       */
+/*                                                                                                */
+/* Joost van Stuijvenberg                                                                         */
+/* ============================================================================================== */
+
+#ifndef OBJECTDETECTOR_STATICOBJECTDETECTOR_HPP
+#define OBJECTDETECTOR_STATICOBJECTDETECTOR_HPP
+
+#include <tuple>
+#include <typeindex>
+#include <vector>
+
+#include "opencv2/opencv.hpp"
+
+#include "ObjectDetector.hpp"
+
+/* ---------------------------------------------------------------------------------------------- */
+/* Static object detector                                                                         */
+/*                                                                                                */
+/* An object detector with a threshold algorithm and filters that are fixed at compile time, e.g. */
+/* StaticObjectDetector<ThresholdRangeAlgorithm, AreaFilter, InertiaFilter>. The filters are      */
+/* called directly rather than through their virtual filter() function, so the compiler can       */
+/* inline the whole chain. Contour features are computed only when a filter asks for them, and   */
+/* the filters are evaluated in the order given, so the cheapest and most selective ones should   */
+/* come first. The keypoints are the same as those of an ObjectDetector with the same threshold   */
+/* algorithm, filters and minimum distance between objects.                                       */
+/* ---------------------------------------------------------------------------------------------- */
+template<typename ThresholdAlgorithmT, typename... Filters>
+class StaticObjectDetector {
+public:
+    inline explicit StaticObjectDetector(ThresholdAlgorithmT thresholdAlgorithm, Filters... filters)
+            : _thresholdAlgorithm(std::move(thresholdAlgorithm)), _filters(std::move(filters)...),
+              _minDistBetweenObjects(10.0) {}
+    inline double minDistBetweenObjects() const { return _minDistBetweenObjects; }
+    inline void minDistBetweenObjects(double minDistBetweenObjects) { _minDistBetweenObjects = minDistBetweenObjects; }
+    inline const ThresholdAlgorithmT &thresholdAlgorithm() const { return _thresholdAlgorithm; }
+    inline ThresholdAlgorithmT &thresholdAlgorithm() { return _thresholdAlgorithm; }
+    template<size_t I> inline const typename std::tuple_element<I, std::tuple<Filters...>>::type &filter() const {
+        return std::get<I>(_filters);
+    }
+    template<size_t I> inline typename std::tuple_element<I, std::tuple<Filters...>>::type &filter() {
+        return std::get<I>(_filters);
+    }
+    inline std::vector<cv::KeyPoint> detect(const cv::Mat &image) { return detect(image, _context); }
+    inline std::vector<cv::KeyPoint> detect(const cv::Mat &image, DetectionContext &context) const;
+private:
+    ThresholdAlgorithmT _thresholdAlgorithm;
+    std::tuple<Filters...> _filters;
+    double _minDistBetweenObjects;
+    DetectionContext _context;
+    inline void findObjects(const cv::Mat &gray, const cv::Mat &binaryImage, const std::vector<cv::Point> &contour,
+                            const cv::Moments &moments, LevelFeatures *level, LevelScratch &scratch,
+                            std::vector<Center> &centers) const;
+
+    // Applies filter I and the ones after it, until one of them filters out the contour.
+    template<size_t I>
+    inline typename std::enable_if<I == sizeof...(Filters), bool>::type
+    filtered(const ContourFeatures &, Center &) const { return false; }
+    template<size_t I>
+    inline typename std::enable_if<I < sizeof...(Filters), bool>::type
+    filtered(const ContourFeatures &features, Center &center) const {
+        typedef typename std::tuple_element<I, std::tuple<Filters...>>::type FilterT;
+        return std::get<I>(_filters).FilterT::filter(features, center) || filtered<I + 1>(features, center);
+    }
+};
+
+/* ---------------------------------------------------------------------------------------------- */
+template<typename ThresholdAlgorithmT, typename... Filters>
+std::vector<cv::KeyPoint> StaticObjectDetector<ThresholdAlgorithmT, Filters...>::detect(const cv::Mat &image,
+                                                                                       DetectionContext &context) const
+{
+    assert(image.data != nullptr);
+
+    cv::Mat gray;
+    bool thresholded = false;
+    if (image.channels() == 3 || image.channels() == 4) {
+        thresholded = _thresholdAlgorithm.ThresholdAlgorithmT::binaryImagesFromColor(image, context.gray,
+                                                                                     context.binaryImages,
+                                                                                     context.levelCounts);
+        if (!thresholded)
+            cvtColor(image, context.gray, cv::COLOR_BGR2GRAY);
+        gray = context.gray;
+    } else
+        gray = image;
+    assert(gray.type() == CV_8UC1);
+
+    // The scratch state of the threshold algorithm may have been created by an algorithm of another type.
+    if (context.thresholdAlgorithmType != typeid(ThresholdAlgorithmT)) {
+        context.thresholdAlgorithm = nullptr;
+        context.thresholdAlgorithmType = typeid(ThresholdAlgorithmT);
+        context.thresholdContext = _thresholdAlgorithm.createContext();
+    }
+    if (context.scratch.empty())
+        context.scratch.resize(1);
+    auto &scratch = context.scratch[0];
+
+    // Find the objects in each level, from the regions or from the binary images.
+    auto &levels = context.levels;
+    if (!thresholded &&
+        _thresholdAlgorithm.ThresholdAlgorithmT::regions(gray, context.regions, context.thresholdContext.get())) {
+        cv::Mat noBinaryImage;
+        levels.resize(context.regions.size());
+        context.levelCounts.assign(levels.size(), 1);
+        for (size_t i = 0; i < levels.size(); i++) {
+            levels[i].clear();
+            for (auto &region : context.regions[i])
+                findObjects(gray, noBinaryImage, region.contour, region.moments, nullptr, scratch, levels[i]);
+        }
+    } else {
+        if (!thresholded)
+            _thresholdAlgorithm.ThresholdAlgorithmT::binaryImages(gray, context.binaryImages, context.levelCounts);
+        levels.resize(context.levelCounts.size());
+        auto &contours = scratch.contours;
+        for (size_t i = 0; i < levels.size(); i++) {
+            levels[i].clear();
+            findContours(context.binaryImages[i], contours, cv::RETR_LIST, cv::CHAIN_APPROX_SIMPLE);
+            LevelFeatures level;
+            for (auto &contour : contours)
+                findObjects(gray, context.binaryImages[i], contour, moments(cv::Mat(contour), true), &level,
+                            scratch, levels[i]);
+        }
+    }
+
+    auto &grouping = context.grouping;
+    grouping.minDistBetweenObjects(_minDistBetweenObjects);
+    for (size_t i = 0; i < levels.size(); i++)
+        for (int n = 0; n < context.levelCounts[i]; n++)
+            grouping.addLevel(levels[i]);
+    return groupKeypoints(grouping.groups(), _thresholdAlgorithm.minRepeatability());
+}
+
+/* ---------------------------------------------------------------------------------------------- */
+/* Applies the filters to one contour, and adds it to centers when it passes all of them.         */
+/* ---------------------------------------------------------------------------------------------- */
+template<typename ThresholdAlgorithmT, typename... Filters>
+void StaticObjectDetector<ThresholdAlgorithmT, Filters...>::findObjects(const cv::Mat &gray, const cv::Mat &binaryImage,
+                                                                        const std::vector<cv::Point> &contour,
+                                                                        const cv::Moments &moments, LevelFeatures *level,
+                                                                        LevelScratch &scratch,
+                                                                        std::vector<Center> &centers) const
+{
+    if (moments.m00 == 0.0)
+        return;
+    Center center;
+    center.confidence = 1;
+    ContourFeatures features(gray, binaryImage, contour, moments, level);
+    if (filtered<0>(features, center))
+        return;
+    locateObject(features, center, scratch.distances);
+    centers.push_back(center);
+}
+
+#endif //OBJECTDETECTOR_STATICOBJECTDETECTOR_HPP
@@ -0,0 +1,188 @@
+/* ============================================================================================== */
+/* StreamDetector.hpp                                                                             */
+/*                                                                                                */
+/* This file is part of ObjectDetector (github.com/joostvanstuijvenberg/ObjectDetector.git)       */
+/*                                                                                                */
+/* Joost van Stuijvenberg                                                                         */
+/* ============================================================================================== */
+
+#ifndef OBJECTDETECTOR_STREAMDETECTOR_HPP
+#define OBJECTDETECTOR_STREAMDETECTOR_HPP
+
+#include <algorithm>
+#include <cmath>
+#include <memory>
+#include <tuple>
+#include <vector>
+
+#include "opencv2/opencv.hpp"
+
+#include "ObjectDetector.hpp"
+
+/* ---------------------------------------------------------------------------------------------- */
+/* An object that is followed from frame to frame.                                                */
+/* ---------------------------------------------------------------------------------------------- */
+struct Track
+{
+    int id;
+    cv::Point2f position;
+    cv::Point2f velocity;       // pixels per frame
+    float size;
+    int missed;                 // number of consecutive frames the object was not found
+    size_t frames;              // number of frames the object was found in
+    inline cv::Point2f predicted() const { return position + velocity; }
+};
+
+/* ---------------------------------------------------------------------------------------------- */
+/* Stream detector                                                                                */
+/*                                                                                                */
+/* Detects objects in consecutive video frames, and keeps track of each object from frame to      */
+/* frame. Rather than processing every frame as a whole, it predicts where each known object will */
+/* be and only processes a window around that position. The whole frame is processed for the      */
+/* first frame, every rescan interval frames (to find objects that have arrived) and whenever no  */
+/* objects are being tracked. The keypoints that are returned carry the id of their track in      */
+/* class_id.                                                                                      */
+/*                                                                                                */
+/* Detections are assigned to tracks greedily, closest first, within the object's size plus the   */
+/* search margin. A track that is not found for more than maxMissed frames is dropped.            */
+/* ---------------------------------------------------------------------------------------------- */
+class StreamDetector {
+public:
+    inline explicit StreamDetector(std::shared_ptr<const ObjectDetector> detector)
+            : _detector(std::move(detector)), _rescanInterval(30), _searchMargin(8), _maxMissed(3),
+              _frame(0), _nextId(0) {
+        assert(_detector != nullptr);
+    }
+    inline size_t rescanInterval() const { return _rescanInterval; }
+    inline void rescanInterval(size_t rescanInterval) { _rescanInterval = rescanInterval; }
+    inline int searchMargin() const { return _searchMargin; }
+    inline void searchMargin(int searchMargin) { _searchMargin = searchMargin; }
+    inline int maxMissed() const { return _maxMissed; }
+    inline void maxMissed(int maxMissed) { _maxMissed = maxMissed; }
+    inline const std::vector<Track> &tracks() const { return _tracks; }
+    inline const std::vector<cv::Rect> &windows() const { return _windows; }
+    inline void reset() { _tracks.clear(); _windows.clear(); _frame = 0; _nextId = 0; }
+    inline std::vector<cv::KeyPoint> process(const cv::Mat &frame);
+private:
+    std::shared_ptr<const ObjectDetector> _detector;
+    size_t _rescanInterval;
+    int _searchMargin;
+    int _maxMissed;
+    size_t _frame;
+    int _nextId;
+    std::vector<Track> _tracks;
+    std::vector<cv::Rect> _windows;
+    cv::Mat _gray;
+    DetectionContext _context;
+    inline void detectInWindows(const cv::Mat &gray, std::vector<cv::KeyPoint> &keypoints);
+    inline void updateTracks(std::vector<cv::KeyPoint> &keypoints);
+};
+
+/* ---------------------------------------------------------------------------------------------- */
+std::vector<cv::KeyPoint> StreamDetector::process(const cv::Mat &frame)
+{
+    assert(frame.data != nullptr);
+
+    // Convert the frame to grayscale once, rather than once per window.
+    cv::Mat gray;
+    if (frame.channels() == 3 || frame.channels() == 4) {
+        cvtColor(frame, _gray, cv::COLOR_BGR2GRAY);
+        gray = _gray;
+    } else
+        gray = frame;
+
+    std::vector<cv::KeyPoint> keypoints;
+    bool rescan = _tracks.empty() || (_rescanInterval > 0 && _frame % _rescanInterval == 0);
+    if (rescan) {
+        _windows.assign(1, cv::Rect(0, 0, gray.cols, gray.rows));
+        keypoints = _detector->detect(gray, _context);
+    } else
+        detectInWindows(gray, keypoints);
+    _frame++;
+
+    updateTracks(keypoints);
+    return keypoints;
+}
+
+/* ---------------------------------------------------------------------------------------------- */
+/* Detects the objects in windows around the predicted positions of the tracked objects. Objects  */
+/* that are cut off by the edge of a window are ignored, since their center would be wrong.       */
+/* ---------------------------------------------------------------------------------------------- */
+void StreamDetector::detectInWindows(const cv::Mat &gray, std::vector<cv::KeyPoint> &keypoints)
+{
+    cv::Rect bounds(0, 0, gray.cols, gray.rows);
+    _windows.clear();
+    for (auto &track : _tracks) {
+        auto p = track.predicted();
+        int half = (int)std::ceil(track.size / 2 + _searchMargin + cv::norm(track.velocity));
+        auto window = cv::Rect((int)p.x - half, (int)p.y - half, 2 * half + 1, 2 * half + 1) & bounds;
+        if (window.area() > 0)
+            _windows.push_back(window);
+    }
+    mergeOverlapping(_windows);
+
+    for (auto &window : _windows)
+        for (auto &keypoint : _detector->detect(gray(window), _context)) {
+            if (cutOff(keypoint, window, gray.size()))
+                continue;
+            keypoint.pt.x += window.x;
+            keypoint.pt.y += window.y;
+            keypoints.push_back(keypoint);
+        }
+}
+
+/* ---------------------------------------------------------------------------------------------- */
+/* Assigns the keypoints to the tracks, starts new tracks for the keypoints that remain and drops */
+/* tracks that have been missing for too long. Sets the track id of each keypoint.                */
+/* ---------------------------------------------------------------------------------------------- */
+void StreamDetector::updateTracks(std::vector<cv::KeyPoint> &keypoints)
+{
+    // All pairs of a track and a keypoint that are close enough, closest first.
+    std::vector<std::tuple<double, size_t, size_t>> pairs;
+    for (size_t t = 0; t < _tracks.size(); t++) {
+        auto p = _tracks[t].predicted();
+        double gate = _tracks[t].size / 2 + _searchMargin;
+        for (size_t k = 0; k < keypoints.size(); k++) {
+            double dist = cv::norm(keypoints[k].pt - p);
+            if (dist <= gate)
+                pairs.emplace_back(dist, t, k);
+        }
+    }
+    std::sort(pairs.begin(), pairs.end());
+
+    std::vector<bool> trackFound(_tracks.size(), false), keypointAssigned(keypoints.size(), false);
+    for (auto &pair : pairs) {
+        size_t t = std::get<1>(pair), k = std::get<2>(pair);
+        if (trackFound[t] || keypointAssigned[k])
+            continue;
+        trackFound[t] = keypointAssigned[k] = true;
+        auto &track = _tracks[t];
+        track.velocity = 0.5f * track.velocity + 0.5f * (keypoints[k].pt - track.position);
+        track.position = keypoints[k].pt;
+        track.size = keypoints[k].size;
+        track.missed = 0;
+        track.frames++;
+        keypoints[k].class_id = track.id;
+    }
+
+    // Tracks that were not found keep moving as predicted, for a while.
+    size_t kept = 0;
+    for (size_t t = 0; t < _tracks.size(); t++) {
+        auto &track = _tracks[t];
+        if (!trackFound[t]) {
+            track.position = track.predicted();
+            if (++track.missed > _maxMissed)
+                continue;
+        }
+        _tracks[kept++] = track;
+    }
+    _tracks.resize(kept);
+
+    for (size_t k = 0; k < keypoints.size(); k++)
+        if (!keypointAssigned[k]) {
+            keypoints[k].class_id = _nextId;
+            _tracks.push_back(Track{_nextId++, keypoints[k].pt, cv::Point2f(0, 0), keypoints[k].size, 0, 1});
+        }
+}
+
+#endif //OBJECTDETECTOR_STREAMDETECTOR_HPP
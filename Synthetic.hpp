@@ -0,0 +1,156 @@
+/* ============================================================================================== */
+/* Synthetic.hpp                                                                                  */
+/*                                                                                                */
+/* This file is part of ObjectDetector (github.com/joostvanstuijvenberg/ObjectDetector.git)       */
+/*                                                                                                */
+/* Synthetic input, and reference implementations, for the benchmark and the tests.               */
+/*                                                                                                */
+/* Joost van Stuijvenberg                                                                         */
+/* ============================================================================================== */
+
+#ifndef OBJECTDETECTOR_SYNTHETIC_HPP
+#define OBJECTDETECTOR_SYNTHETIC_HPP
+
+#include <algorithm>
+#include <cmath>
+#include <iterator>
+#include <random>
+#include <vector>
+
+#include "opencv2/opencv.hpp"
+
+#include "Filter.hpp"
+
+/* ---------------------------------------------------------------------------------------------- */
+/* Parameters of a synthetic image: a background with blobs of random brightness, of which a part */
+/* is elongated, plus gaussian noise. The same parameters always yield the same image.            */
+/* ---------------------------------------------------------------------------------------------- */
+struct BlobField
+{
+    int width = 1920, height = 1080;
+    size_t blobs = 1000;
+    int minRadius = 4, maxRadius = 20;
+    double elongated = 0.2;
+    double noise = 8.0;
+    unsigned int seed = 42;
+};
+
+/* ---------------------------------------------------------------------------------------------- */
+inline cv::Mat generateBlobField(const BlobField &field) {
+    cv::Mat image(field.height, field.width, CV_8UC1, cv::Scalar(30));
+    std::mt19937 rng(field.seed);
+    std::uniform_int_distribution<int> x(0, field.width - 1), y(0, field.height - 1);
+    std::uniform_int_distribution<int> r(field.minRadius, field.maxRadius), gray(60, 220), angle(0, 179);
+    std::uniform_real_distribution<double> chance(0, 1);
+    for (size_t i = 0; i < field.blobs; i++) {
+        cv::Point center(x(rng), y(rng));
+        int radius = r(rng);
+        cv::Scalar color(gray(rng));
+        if (chance(rng) < field.elongated)
+            cv::ellipse(image, center, cv::Size(radius, std::max(1, radius / 3)), angle(rng), 0, 360, color, -1);
+        else
+            cv::circle(image, center, radius, color, -1);
+    }
+
+    if (field.noise > 0) {
+        std::normal_distribution<double> noise(0, field.noise);
+        for (int row = 0; row < image.rows; row++) {
+            auto p = image.ptr<uchar>(row);
+            for (int col = 0; col < image.cols; col++)
+                p[col] = cv::saturate_cast<uchar>(p[col] + noise(rng));
+        }
+    }
+    return image;
+}
+
+/* ---------------------------------------------------------------------------------------------- */
+/* Grouping by comparing every center with every group, as a reference.                           */
+/* ---------------------------------------------------------------------------------------------- */
+inline std::vector<std::vector<Center>> groupNaive(const std::vector<std::vector<Center>> &levels, double minDist) {
+    std::vector<std::vector<Center>> centers;
+    for (auto &curCenters : levels) {
+        std::vector<std::vector<Center> > newCenters;
+        for (auto &curCenter : curCenters) {
+            bool isNew = true;
+            for (auto &center : centers) {
+                double dist = norm(center[center.size() / 2].location - curCenter.location);
+                isNew = dist >= minDist && dist >= center[center.size() / 2].radius && dist >= curCenter.radius;
+                if (!isNew) {
+                    center.push_back(curCenter);
+                    size_t k = center.size() - 1;
+                    while (k > 0 && curCenter.radius < center[k - 1].radius) {
+                        center[k] = center[k - 1];
+                        k--;
+                    }
+                    center[k] = curCenter;
+                    break;
+                }
+            }
+            if (isNew)
+                newCenters.emplace_back(1, curCenter);
+        }
+        copy(newCenters.begin(), newCenters.end(), back_inserter(centers));
+    }
+    return centers;
+}
+
+/* ---------------------------------------------------------------------------------------------- */
+/* Simulates the centers that a number of threshold levels would yield for a field of blobs: each  */
+/* blob shows up at most levels with a slightly different location and radius.                    */
+/* ---------------------------------------------------------------------------------------------- */
+inline std::vector<std::vector<Center>> blobLevels(size_t blobs, size_t levels, std::mt19937 &rng) {
+    // Spread the blobs over a square area with room for about 40 x 40 pixels per blob.
+    double side = std::sqrt((double)blobs) * 40.0;
+    std::uniform_real_distribution<double> position(0, side), radius(2, 12), jitter(-1.5, 1.5), chance(0, 1);
+    std::vector<Center> blobCenters(blobs);
+    for (auto &c : blobCenters) {
+        c.location = cv::Point2d(position(rng), position(rng));
+        c.radius = radius(rng);
+        c.confidence = 1;
+    }
+
+    std::vector<std::vector<Center>> result(levels);
+    for (auto &level : result)
+        for (auto &c : blobCenters) {
+            if (chance(rng) < 0.1)
+                continue;
+            Center l = c;
+            l.location += cv::Point2d(jitter(rng), jitter(rng));
+            l.radius = std::max(0.5, c.radius + jitter(rng));
+            level.push_back(l);
+        }
+    return result;
+}
+
+/* ---------------------------------------------------------------------------------------------- */
+inline bool sameGroups(const std::vector<std::vector<Center>> &a, const std::vector<std::vector<Center>> &b) {
+    if (a.size() != b.size())
+        return false;
+    for (size_t i = 0; i < a.size(); i++) {
+        if (a[i].size() != b[i].size())
+            return false;
+        for (size_t j = 0; j < a[i].size(); j++)
+            if (a[i][j].location != b[i][j].location || a[i][j].radius != b[i][j].radius)
+                return false;
+    }
+    return true;
+}
+
+/* ---------------------------------------------------------------------------------------------- */
+/* sameKeypointSets() - whether both have the same keypoints, in any order, with locations and    */
+/* sizes that differ at most the given tolerance.                                                 */
+/* ---------------------------------------------------------------------------------------------- */
+inline bool sameKeypointSets(const std::vector<cv::KeyPoint> &a, const std::vector<cv::KeyPoint> &b, double tolerance) {
+    if (a.size() != b.size())
+        return false;
+    for (auto &p : a) {
+        bool found = false;
+        for (auto &q : b)
+            found = found || (cv::norm(p.pt - q.pt) <= tolerance && std::abs(p.size - q.size) <= tolerance);
+        if (!found)
+            return false;
+    }
+    return true;
+}
+
+#endif //OBJECTDETECTOR_SYNTHETIC_HPP
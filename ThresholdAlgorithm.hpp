@@ -9,14 +9,100 @@
 #ifndef OBJECTDETECTOR_THRESHOLDALGORITHM_HPP
 #define OBJECTDETECTOR_THRESHOLDALGORITHM_HPP
 
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
 #include <memory>
 #include <sstream>
+#include <string>
 #include <utility>
 #include <vector>
 
+#if defined(__AVX__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
 #include "opencv2/opencv.hpp"
 
 #include "Persistence.hpp"
+#include "RunLengthImage.hpp"
+
+/*!
+ *  A connected region of one threshold level, as reported by algorithms that segment the image themselves.
+ */
+struct Region
+{
+    cv::Moments moments;
+    std::vector<cv::Point> contour;
+};
+
+/*!
+ * Follows the outer border of the region that contains the seed pixel, which must be the first pixel of the region
+ * in raster order; inside(x, y) tells whether a pixel is set. Only pixels along the border are visited. Straight
+ * horizontal, vertical and diagonal segments are compressed to their end points, like CHAIN_APPROX_SIMPLE does.
+ */
+template<typename Inside>
+inline void traceBorder(const cv::Point &seed, Inside inside, std::vector<cv::Point> &border,
+                        std::vector<cv::Point> &contour)
+{
+    // Neighbour offsets in clockwise order, starting east.
+    static const int dx[] = {1, 1, 0, -1, -1, -1, 0, 1};
+    static const int dy[] = {0, 1, 1, 1, 0, -1, -1, -1};
+
+    border.clear();
+    const cv::Point p0 = seed;
+    border.push_back(p0);
+
+    // Look clockwise around the seed, starting at its (background) west neighbour, for the last border pixel.
+    int d1 = -1;
+    for (int i = 5; i < 13 && d1 < 0; i++)
+        if (inside(p0.x + dx[i % 8], p0.y + dy[i % 8]))
+            d1 = i % 8;
+    if (d1 >= 0) {
+        cv::Point p1(p0.x + dx[d1], p0.y + dy[d1]);
+        cv::Point p3 = p0;
+        int back = d1;
+        while (true) {
+            // Look counterclockwise around p3, starting right after the previous border pixel.
+            int d = back;
+            cv::Point p4;
+            for (int i = 1; i <= 8; i++) {
+                d = (back + 8 - i) % 8;
+                p4 = cv::Point(p3.x + dx[d], p3.y + dy[d]);
+                if (inside(p4.x, p4.y))
+                    break;
+            }
+            if (p4 == p0 && p3 == p1)
+                break;
+            border.push_back(p4);
+            back = (d + 4) % 8;
+            p3 = p4;
+        }
+    }
+
+    contour.clear();
+    auto n = border.size();
+    for (size_t i = 0; i < n; i++) {
+        auto prev = border[(i + n - 1) % n];
+        auto next = border[(i + 1) % n];
+        if (n <= 2 || border[i] - prev != next - border[i])
+            contour.push_back(border[i]);
+    }
+}
+
+/*!
+ *  Scratch state that a threshold algorithm needs while processing an image. Algorithms that need any derive their
+ *  own context from this class; the object detector keeps one per DetectionContext, so that a single algorithm can
+ *  process images on several threads at once.
+ */
+class ThresholdContext
+{
+public:
+    virtual ~ThresholdContext() = default;
+};
 
 /*!
  *  This class serves as the base of all threshold algorithms. You can subclass your own threshold algorithm from this class.
@@ -25,24 +111,150 @@ class ThresholdAlgorithm
 {
 public:
     inline explicit ThresholdAlgorithm(int minRepeatability = 1) : _minRepeatability(minRepeatability) {}
-    inline void setImage(cv::Mat image) { _image = std::move(image); }
-    inline int minRepeatability() { return _minRepeatability; }
+    inline int minRepeatability() const { return _minRepeatability; }
     inline void minRepeatability(int minRepeatability) { _minRepeatability = minRepeatability; }
-    virtual std::vector<cv::Mat> binaryImages() = 0;
+    /*!
+     * Thresholds the image into the given binary images, one per level. The vector and the images in it are
+     * reused: an image that already has the right size and type is overwritten instead of reallocated, so
+     * passing the same vector on every call avoids allocating image data once it has been filled. This function
+     * does not change the algorithm, so it may be called from several threads at once.
+     * @param image the grayscale image
+     * @param binaryImages receives the binary images; it is resized to the number of levels
+     */
+    virtual void binaryImages(const cv::Mat &image, std::vector<cv::Mat> &binaryImages) const = 0;
+    inline std::vector<cv::Mat> binaryImages(const cv::Mat &image) const {
+        std::vector<cv::Mat> result;
+        binaryImages(image, result);
+        return result;
+    }
+    /*!
+     * Same as above, but levels that would yield the same binary image as the level before them may be left
+     * out. levelCounts receives, for each binary image, the number of consecutive levels it stands for, so
+     * that the objects found in it can be counted that many times. By default no levels are left out. Since the
+     * number of levels left out may change from image to image, the vector of binary images is not shrunk: only
+     * the first levelCounts.size() images are valid, and the ones after them are kept for later calls.
+     * @param image the grayscale image
+     * @param binaryImages receives the binary images; only the first levelCounts.size() are valid
+     * @param levelCounts receives the number of levels each binary image stands for
+     */
+    virtual void binaryImages(const cv::Mat &image, std::vector<cv::Mat> &binaryImages,
+                              std::vector<int> &levelCounts) const {
+        this->binaryImages(image, binaryImages);
+        levelCounts.assign(binaryImages.size(), 1);
+    }
+    /*!
+     * Algorithms that threshold the grayscale image at one or more fixed values can override this function to
+     * convert a color image to grayscale and threshold it in a single pass: strip by strip, so that each strip of
+     * the grayscale image is still in the cache when it is thresholded for every level. The result is the same as
+     * that of cvtColor() followed by binaryImages() with level counts.
+     * @param image the BGR or BGRA image
+     * @param gray receives the grayscale image, which the filters may still need
+     * @param binaryImages receives the binary images; only the first levelCounts.size() are valid
+     * @param levelCounts receives the number of levels each binary image stands for
+     * @return false when the algorithm does not support this; the image must be converted to grayscale first
+     */
+    virtual bool binaryImagesFromColor(const cv::Mat &image, cv::Mat &gray, std::vector<cv::Mat> &binaryImages,
+                                       std::vector<int> &levelCounts) const { return false; }
+    /*!
+     * Same as binaryImages() with level counts, but yields run-length encoded images, which take far less memory
+     * than 8-bit images. By default the binary images are computed and then encoded; algorithms that threshold at
+     * fixed values override this to encode the levels straight from the grayscale image.
+     * @param image the grayscale image
+     * @param levels receives the run-length encoded binary images
+     * @param levelCounts receives the number of levels each image stands for
+     */
+    virtual void runLengthImages(const cv::Mat &image, std::vector<RunLengthImage> &levels,
+                                 std::vector<int> &levelCounts) const {
+        std::vector<cv::Mat> binaryImages;
+        this->binaryImages(image, binaryImages, levelCounts);
+        levels.resize(levelCounts.size());
+        for (size_t l = 0; l < levels.size(); l++)
+            levels[l].encode(binaryImages[l]);
+    }
+    /*!
+     * Creates the scratch state this algorithm needs for regions(), if any.
+     */
+    virtual std::unique_ptr<ThresholdContext> createContext() const { return nullptr; }
+    /*!
+     * Algorithms that find the connected regions of every level themselves can override this function, so the
+     * object detector does not need to run findContours() on the binary images.
+     * @param image the grayscale image
+     * @param levels receives the regions of each level, in the same order as binaryImages() would return them
+     * @param context the scratch state created by createContext(); one per thread
+     * @return false when the algorithm does not report regions; binaryImages() must be used instead
+     */
+    virtual bool regions(const cv::Mat &image, std::vector<std::vector<Region>> &levels,
+                         ThresholdContext *context) const { return false; }
     virtual void read(const cv::FileNode &node) = 0;
     virtual void write(cv::FileStorage &storage) const = 0;
 protected:
-    cv::Mat _image;
     int _minRepeatability;
-    std::vector<cv::Mat> result;
-    void debug(std::vector<cv::Mat>& storage);
+    static void debug(const std::vector<cv::Mat>& storage);
+    static inline void thresholdColor(const cv::Mat &image, cv::Mat &gray, const std::vector<int> &thresholds,
+                                      std::vector<cv::Mat> &binaryImages, size_t *histogram = nullptr);
+    static inline void thresholdRunLength(const cv::Mat &image, const std::vector<int> &thresholds,
+                                          std::vector<RunLengthImage> &levels);
 };
 
+/*!
+ * Encodes the pixels of the image above each of the given values, one row at a time for all levels, so that each row
+ * is read from memory only once.
+ */
+void ThresholdAlgorithm::thresholdRunLength(const cv::Mat &image, const std::vector<int> &thresholds,
+                                            std::vector<RunLengthImage> &levels)
+{
+    assert(image.type() == CV_8UC1);
+    levels.resize(thresholds.size());
+    for (auto &level : levels)
+        level.reset(image.cols);
+    for (int y = 0; y < image.rows; y++) {
+        auto row = image.ptr<uchar>(y);
+        for (size_t l = 0; l < thresholds.size(); l++)
+            levels[l].addRow(row, thresholds[l]);
+    }
+}
+
+/*!
+ * Converts the color image to grayscale and thresholds it at each of the given values, a strip of rows at a time.
+ * The strips are small enough for the grayscale strip to stay in the cache while it is being thresholded, so the
+ * grayscale image is written to memory once and never read back from it. Like binaryImages() with level counts,
+ * the vector of binary images is only ever enlarged.
+ * @param histogram when not null, receives the number of pixels of each grayscale value (it is not cleared)
+ */
+void ThresholdAlgorithm::thresholdColor(const cv::Mat &image, cv::Mat &gray, const std::vector<int> &thresholds,
+                                        std::vector<cv::Mat> &binaryImages, size_t *histogram)
+{
+    assert(image.type() == CV_8UC3 || image.type() == CV_8UC4);
+    const int stripPixels = 64 * 1024;
+    gray.create(image.size(), CV_8UC1);
+    if (binaryImages.size() < thresholds.size())
+        binaryImages.resize(thresholds.size());
+    for (size_t l = 0; l < thresholds.size(); l++)
+        binaryImages[l].create(image.size(), CV_8UC1);
+
+    int strip = std::max(1, stripPixels / std::max(image.cols, 1));
+    for (int y = 0; y < image.rows; y += strip) {
+        cv::Range rows(y, std::min(y + strip, image.rows));
+        cv::Mat grayStrip = gray.rowRange(rows);
+        cvtColor(image.rowRange(rows), grayStrip, cv::COLOR_BGR2GRAY);
+        for (size_t l = 0; l < thresholds.size(); l++) {
+            cv::Mat binaryStrip = binaryImages[l].rowRange(rows);
+            cv::threshold(grayStrip, binaryStrip, thresholds[l], 255, cv::THRESH_BINARY);
+        }
+        if (histogram != nullptr)
+            for (int r = 0; r < grayStrip.rows; r++) {
+                auto row = grayStrip.ptr<uchar>(r);
+                for (int x = 0; x < grayStrip.cols; x++)
+                    histogram[row[x]]++;
+            }
+    }
+}
+
 /*!
  * This function allows visual inspection of the thresholding process, by showing all the intermediate binary images.
  * @param storage
  */
-void ThresholdAlgorithm::debug(std::vector<cv::Mat>& storage)
+void ThresholdAlgorithm::debug(const std::vector<cv::Mat>& storage)
 {
     int w = 0;
     std::vector<std::string> winNames;
@@ -69,13 +281,22 @@ public:
     : ThresholdAlgorithm(1), _threshold(threshold) {
         assert(_minRepeatability == 1);
     }
-    inline std::vector<cv::Mat> binaryImages() override {
-        result.clear();
-        auto thr = new cv::Mat();
-        cv::threshold(_image, *thr, _threshold, 255, cv::THRESH_BINARY);
-        result.emplace_back(*thr);
-        //debug(result);
-        return result;
+    using ThresholdAlgorithm::binaryImages;
+    inline void binaryImages(const cv::Mat &image, std::vector<cv::Mat> &binaryImages) const override {
+        binaryImages.resize(1);
+        cv::threshold(image, binaryImages[0], _threshold, 255, cv::THRESH_BINARY);
+        //debug(binaryImages);
+    }
+    inline bool binaryImagesFromColor(const cv::Mat &image, cv::Mat &gray, std::vector<cv::Mat> &binaryImages,
+                                      std::vector<int> &levelCounts) const override {
+        thresholdColor(image, gray, std::vector<int>(1, _threshold), binaryImages);
+        levelCounts.assign(1, 1);
+        return true;
+    }
+    inline void runLengthImages(const cv::Mat &image, std::vector<RunLengthImage> &levels,
+                                std::vector<int> &levelCounts) const override {
+        thresholdRunLength(image, std::vector<int>(1, _threshold), levels);
+        levelCounts.assign(1, 1);
     }
     inline void read(const cv::FileNode &node) override {
         _threshold = (int)node[NODE_THRESHOLD];
@@ -91,6 +312,11 @@ private:
 /*!
  *  This class implements the threshold range algorithm, which uses a range of threshold values, specified by
  *  a minimum and maximum threshold value (both inclusive) and a step size.
+ *
+ *  When asked for level counts, it uses the histogram of the image to leave out levels whose binary image would
+ *  equal that of the previous level, because no pixel values lie between the two thresholds. With a level
+ *  tolerance above 0, levels are also left out when the fraction of pixels that would change is at most the
+ *  tolerance; the objects found are then approximately the same as without leaving out levels.
  */
 class ThresholdRangeAlgorithm: public ThresholdAlgorithm
 {
@@ -99,21 +325,27 @@ public:
     : ThresholdAlgorithm(minRepeatability),_min(min), _max(max), _step(step) {
         assert(_minRepeatability <= (max - min) / step);
     }
-    inline std::vector<cv::Mat>  binaryImages() override {
-        result.clear();
-        for (auto i = _min; i <= _max; i += _step) {
-            auto thr = new cv::Mat;
-            cv::threshold(_image, *thr, i, 255, cv::THRESH_BINARY);
-            result.emplace_back(*thr);
-        }
-        //debug(result);
-        return result;
+    using ThresholdAlgorithm::binaryImages;
+    inline void binaryImages(const cv::Mat &image, std::vector<cv::Mat> &binaryImages) const override {
+        binaryImages.resize(levelCount());
+        for (size_t l = 0; l < binaryImages.size(); l++)
+            cv::threshold(image, binaryImages[l], _min + (int)l * _step, 255, cv::THRESH_BINARY);
+        //debug(binaryImages);
     }
+    inline void binaryImages(const cv::Mat &image, std::vector<cv::Mat> &binaryImages,
+                             std::vector<int> &levelCounts) const override;
+    inline bool binaryImagesFromColor(const cv::Mat &image, cv::Mat &gray, std::vector<cv::Mat> &binaryImages,
+                                      std::vector<int> &levelCounts) const override;
+    inline void runLengthImages(const cv::Mat &image, std::vector<RunLengthImage> &levels,
+                                std::vector<int> &levelCounts) const override;
+    inline double levelTolerance() const { return _levelTolerance; }
+    inline void levelTolerance(double levelTolerance) { _levelTolerance = levelTolerance; }
     inline void read(const cv::FileNode &node) override {
         _min = (int)node[NODE_MIN];
         _max = (int)node[NODE_MAX];
         _step = (int)node[NODE_STEP];
         _minRepeatability = (int)node[NODE_MIN_REPEATABLILITY];
+        _levelTolerance = (double)node[NODE_LEVEL_TOLERANCE];
     };
     inline void write(cv::FileStorage &storage) const override {
         storage << NODE_TYPE << THRESHOLD_ALGORITHM_RANGE;
@@ -121,11 +353,108 @@ public:
         storage << NODE_MAX << _max;
         storage << NODE_STEP << _step;
         storage << NODE_MIN_REPEATABLILITY << _minRepeatability;
+        storage << NODE_LEVEL_TOLERANCE << _levelTolerance;
     };
 private:
     int _min, _max, _step;
+    double _levelTolerance = 0;
+    inline int levelCount() const { return _max >= _min ? (_max - _min) / _step + 1 : 0; }
+    inline void groupLevels(const size_t histogram[256], size_t total, std::vector<int> &firstLevels,
+                            std::vector<int> &levelCounts) const;
+    inline void groupLevels(const cv::Mat &image, std::vector<int> &firstLevels, std::vector<int> &levelCounts) const;
 };
 
+/*!
+ * Groups consecutive levels whose binary images are the same (or, with a level tolerance, nearly the same), given
+ * the histogram of the image. firstLevels receives the first level of each group and levelCounts its size.
+ */
+void ThresholdRangeAlgorithm::groupLevels(const size_t histogram[256], size_t total, std::vector<int> &firstLevels,
+                                          std::vector<int> &levelCounts) const
+{
+    // The number of pixels above each value; a pixel is set in the binary image of threshold t when it
+    // is above t.
+    size_t above[257] = {};
+    for (int v = 255; v >= 0; v--)
+        above[v] = above[v + 1] + histogram[v];
+    auto pixelsAbove = [&](int t) { return above[std::min(std::max(t + 1, 0), 256)]; };
+
+    auto tolerance = (size_t)(_levelTolerance * total);
+    firstLevels.clear();
+    levelCounts.clear();
+    for (int l = 0; l < levelCount(); l++) {
+        int t = _min + l * _step;
+        if (!firstLevels.empty() && pixelsAbove(_min + firstLevels.back() * _step) - pixelsAbove(t) <= tolerance) {
+            levelCounts.back()++;
+            continue;
+        }
+        firstLevels.push_back(l);
+        levelCounts.push_back(1);
+    }
+}
+
+/*!
+ * Same as above, from the histogram of the given grayscale image.
+ */
+void ThresholdRangeAlgorithm::groupLevels(const cv::Mat &image, std::vector<int> &firstLevels,
+                                          std::vector<int> &levelCounts) const
+{
+    assert(image.type() == CV_8UC1);
+    size_t histogram[256] = {};
+    for (int y = 0; y < image.rows; y++) {
+        auto row = image.ptr<uchar>(y);
+        for (int x = 0; x < image.cols; x++)
+            histogram[row[x]]++;
+    }
+    groupLevels(histogram, image.total(), firstLevels, levelCounts);
+}
+
+void ThresholdRangeAlgorithm::binaryImages(const cv::Mat &image, std::vector<cv::Mat> &binaryImages,
+                                           std::vector<int> &levelCounts) const
+{
+    std::vector<int> firstLevels;
+    groupLevels(image, firstLevels, levelCounts);
+
+    if (binaryImages.size() < firstLevels.size())
+        binaryImages.resize(firstLevels.size());
+    for (size_t i = 0; i < firstLevels.size(); i++)
+        cv::threshold(image, binaryImages[i], _min + firstLevels[i] * _step, 255, cv::THRESH_BINARY);
+}
+
+/*!
+ * All levels are thresholded in the same pass that yields the histogram; the binary images of levels that turn out
+ * to be the same as the level before them are moved behind the others afterwards, where they are kept for the next
+ * image.
+ */
+bool ThresholdRangeAlgorithm::binaryImagesFromColor(const cv::Mat &image, cv::Mat &gray,
+                                                    std::vector<cv::Mat> &binaryImages,
+                                                    std::vector<int> &levelCounts) const
+{
+    std::vector<int> thresholds(levelCount());
+    for (size_t l = 0; l < thresholds.size(); l++)
+        thresholds[l] = _min + (int)l * _step;
+    size_t histogram[256] = {};
+    thresholdColor(image, gray, thresholds, binaryImages, histogram);
+
+    // Keep the binary image of the first level of each group, in order.
+    std::vector<int> firstLevels;
+    groupLevels(histogram, image.total(), firstLevels, levelCounts);
+    for (size_t i = 0; i < firstLevels.size(); i++)
+        std::swap(binaryImages[i], binaryImages[firstLevels[i]]);
+    return true;
+}
+
+void ThresholdRangeAlgorithm::runLengthImages(const cv::Mat &image, std::vector<RunLengthImage> &levels,
+                                              std::vector<int> &levelCounts) const
+{
+    std::vector<int> firstLevels;
+    groupLevels(image, firstLevels, levelCounts);
+
+    std::vector<int> thresholds;
+    for (auto l : firstLevels)
+        thresholds.push_back(_min + l * _step);
+    thresholdRunLength(image, thresholds, levels);
+}
+
 /*! \
  *  This class implements Otsu's threshold algorithm.
  */
@@ -136,13 +465,11 @@ public:
     : ThresholdAlgorithm(1) {
         assert(_minRepeatability == 1);
     }
-    inline std::vector<cv::Mat>  binaryImages() override {
-        result.clear();
-        auto thr = new cv::Mat;
-        cv::threshold(_image, *thr, 0, 255, cv::THRESH_BINARY | cv::THRESH_OTSU);
-        result.emplace_back(*thr);
-        //debug(result);
-        return result;
+    using ThresholdAlgorithm::binaryImages;
+    inline void binaryImages(const cv::Mat &image, std::vector<cv::Mat> &binaryImages) const override {
+        binaryImages.resize(1);
+        cv::threshold(image, binaryImages[0], 0, 255, cv::THRESH_BINARY | cv::THRESH_OTSU);
+        //debug(binaryImages);
     }
     inline void read(const cv::FileNode &node) override {};
     inline void write(cv::FileStorage &storage) const override {
@@ -150,4 +477,372 @@ public:
     };
 };
 
+/*!
+ *  This class implements a component tree algorithm. It yields the same levels as the threshold range algorithm,
+ *  but finds the connected regions of all levels in a single pass over the image: pixels are added in order of
+ *  decreasing intensity and merged with their (8-connected) neighbours using union-find, while the moments of
+ *  every region are updated incrementally. A region is only traced at the levels where it has grown; at the other
+ *  levels it is copied from the level above. The regions of a level are in the order in which they first appeared
+ *  (from the highest level down), so a region that does not change keeps its place relative to the others.
+ *
+ *  Please note that the moments are pixel moments (i.e. the area is the number of pixels) rather than the
+ *  moments of the contour polygon, and that holes in regions are not reported as separate regions.
+ */
+class ThresholdComponentTreeAlgorithm: public ThresholdAlgorithm
+{
+public:
+    inline explicit ThresholdComponentTreeAlgorithm(int min = 0, int max = 0, int step = 1, int minRepeatability = 0)
+    : ThresholdAlgorithm(minRepeatability), _min(min), _max(max), _step(step) {
+        assert(_minRepeatability <= (max - min) / step);
+    }
+    using ThresholdAlgorithm::binaryImages;
+    inline void binaryImages(const cv::Mat &image, std::vector<cv::Mat> &binaryImages) const override {
+        binaryImages.resize(levelCount());
+        for (size_t l = 0; l < binaryImages.size(); l++)
+            cv::threshold(image, binaryImages[l], _min + (int)l * _step, 255, cv::THRESH_BINARY);
+    }
+    inline std::unique_ptr<ThresholdContext> createContext() const override {
+        return std::unique_ptr<ThresholdContext>(new Context());
+    }
+    inline bool regions(const cv::Mat &image, std::vector<std::vector<Region>> &levels,
+                        ThresholdContext *context) const override;
+    inline void read(const cv::FileNode &node) override {
+        _min = (int)node[NODE_MIN];
+        _max = (int)node[NODE_MAX];
+        _step = (int)node[NODE_STEP];
+        _minRepeatability = (int)node[NODE_MIN_REPEATABLILITY];
+    };
+    inline void write(cv::FileStorage &storage) const override {
+        storage << NODE_TYPE << THRESHOLD_ALGORITHM_COMPONENT_TREE;
+        storage << NODE_MIN << _min;
+        storage << NODE_MAX << _max;
+        storage << NODE_STEP << _step;
+        storage << NODE_MIN_REPEATABLILITY << _minRepeatability;
+    };
+private:
+    // Raw moments (up to the third order) and the first pixel in raster order of a region, and its area and
+    // index among the regions of the level it was last reported at.
+    struct Stats {
+        double m00, m10, m01, m20, m11, m02, m30, m21, m12, m03;
+        int seed;
+        double reportedArea;
+        size_t reported;
+    };
+    // The union-find forest and all other buffers. They are kept between calls, so they only need
+    // to be allocated for the first image.
+    struct Context : public ThresholdContext {
+        int cols;
+        std::vector<int> first, next, order;
+        std::vector<cv::Point> border;
+        // For each pixel: -1 when not yet added, -(slot + 2) for the root of a region, else the parent pixel.
+        std::vector<int> parent;
+        std::vector<Stats> stats;
+        std::vector<int> freeStats;
+        std::vector<int> activeRoots;
+        inline int find(int p);
+        inline void add(int p);
+        inline void merge(int p, int q);
+    };
+    int _min, _max, _step;
+    inline size_t levelCount() const { return _max >= _min ? (_max - _min) / _step + 1 : 0; }
+};
+
+int ThresholdComponentTreeAlgorithm::Context::find(int p)
+{
+    while (parent[p] >= 0) {
+        int q = parent[p];
+        if (parent[q] >= 0)
+            parent[p] = parent[q];
+        p = q;
+    }
+    return p;
+}
+
+void ThresholdComponentTreeAlgorithm::Context::add(int p)
+{
+    int slot;
+    if (freeStats.empty()) {
+        slot = (int)stats.size();
+        stats.emplace_back();
+    } else {
+        slot = freeStats.back();
+        freeStats.pop_back();
+    }
+    double x = p % cols, y = p / cols;
+    stats[slot] = Stats{1, x, y, x * x, x * y, y * y, x * x * x, x * x * y, x * y * y, y * y * y, p, 0, 0};
+    parent[p] = -(slot + 2);
+    activeRoots.push_back(p);
+}
+
+void ThresholdComponentTreeAlgorithm::Context::merge(int p, int q)
+{
+    p = find(p);
+    q = find(q);
+    if (p == q)
+        return;
+
+    // Attach the smaller region to the larger one.
+    auto &sp = stats[-parent[p] - 2];
+    auto &sq = stats[-parent[q] - 2];
+    if (sp.m00 < sq.m00) {
+        merge(q, p);
+        return;
+    }
+    sp.m00 += sq.m00; sp.m10 += sq.m10; sp.m01 += sq.m01;
+    sp.m20 += sq.m20; sp.m11 += sq.m11; sp.m02 += sq.m02;
+    sp.m30 += sq.m30; sp.m21 += sq.m21; sp.m12 += sq.m12; sp.m03 += sq.m03;
+    sp.seed = std::min(sp.seed, sq.seed);
+
+    // q is no longer a root; it is removed from the active roots when the level is reported.
+    freeStats.push_back(-parent[q] - 2);
+    parent[q] = p;
+}
+
+bool ThresholdComponentTreeAlgorithm::regions(const cv::Mat &image, std::vector<std::vector<Region>> &levels,
+                                              ThresholdContext *context) const
+{
+    static const int dx[] = {1, 1, 0, -1, -1, -1, 0, 1};
+    static const int dy[] = {0, 1, 1, 1, 0, -1, -1, -1};
+    assert(image.type() == CV_8UC1);
+    assert(dynamic_cast<Context *>(context) != nullptr);
+    auto &c = *static_cast<Context *>(context);
+    const int pixels = image.rows * image.cols;
+    c.cols = image.cols;
+
+    // Sort the pixels by intensity (counting sort), so they can be added from bright to dark.
+    c.first.assign(257, 0);
+    for (int y = 0; y < image.rows; y++) {
+        auto row = image.ptr<uchar>(y);
+        for (int x = 0; x < image.cols; x++)
+            c.first[row[x] + 1]++;
+    }
+    for (int v = 0; v < 256; v++)
+        c.first[v + 1] += c.first[v];
+    c.order.resize(pixels);
+    c.next.assign(c.first.begin(), c.first.end() - 1);
+    for (int y = 0; y < image.rows; y++) {
+        auto row = image.ptr<uchar>(y);
+        for (int x = 0; x < image.cols; x++)
+            c.order[c.next[row[x]]++] = y * image.cols + x;
+    }
+
+    c.parent.assign(pixels, -1);
+    c.stats.clear();
+    c.freeStats.clear();
+    c.activeRoots.clear();
+
+    levels.resize(levelCount());
+
+    // Walk the levels from the highest threshold down. At each level, add the pixels that exceed it and
+    // report the regions that exist at that moment.
+    int v = 255;
+    for (auto l = (int)levels.size() - 1; l >= 0; l--) {
+        int threshold = _min + l * _step;
+        auto inside = [&](int x, int y) {
+            return x >= 0 && y >= 0 && x < image.cols && y < image.rows && image.at<uchar>(y, x) > threshold;
+        };
+        for (; v > threshold && v >= 0; v--)
+            for (int i = c.first[v]; i < c.first[v + 1]; i++) {
+                int p = c.order[i];
+                int x = p % image.cols, y = p / image.cols;
+                c.add(p);
+                for (int n = 0; n < 8; n++) {
+                    int nx = x + dx[n], ny = y + dy[n];
+                    if (nx >= 0 && ny >= 0 && nx < image.cols && ny < image.rows && c.parent[ny * image.cols + nx] != -1)
+                        c.merge(p, ny * image.cols + nx);
+                }
+            }
+
+        // Drop the roots that were merged into others, keeping the order of the rest. A region with the same
+        // area as at the level above has the same pixels, so it is copied from there rather than traced again.
+        auto merged = [&](int p) { return c.parent[p] >= 0; };
+        c.activeRoots.erase(std::remove_if(c.activeRoots.begin(), c.activeRoots.end(), merged), c.activeRoots.end());
+        auto &level = levels[l];
+        level.resize(c.activeRoots.size());
+        for (size_t r = 0; r < c.activeRoots.size(); r++) {
+            auto &s = c.stats[-c.parent[c.activeRoots[r]] - 2];
+            if (s.reportedArea == s.m00)
+                level[r] = levels[l + 1][s.reported];
+            else {
+                level[r].moments = cv::Moments(s.m00, s.m10, s.m01, s.m20, s.m11, s.m02, s.m30, s.m21, s.m12, s.m03);
+                traceBorder(cv::Point(s.seed % image.cols, s.seed / image.cols), inside, c.border, level[r].contour);
+                s.reportedArea = s.m00;
+            }
+            s.reported = r;
+        }
+    }
+    return true;
+}
+
+/*!
+ *  This class implements local adaptive thresholding: a pixel is set when it is above a threshold computed from the
+ *  block of pixels around it, which copes with uneven illumination that no global threshold can handle. With the
+ *  mean method the threshold is the mean of the block plus delta; with Sauvola's method it is
+ *  mean * (1 + k * (stddev / 128 - 1)), which lowers the threshold in blocks with little contrast. Near the border
+ *  only the part of the block inside the image is used. A single adaptive level can often replace a whole range of
+ *  global levels.
+ *
+ *  The sums over each block are taken from an integral image, which is built one row at a time from running column
+ *  sums, so only a few rows of memory are needed whatever the size of the image. The thresholds of a row are
+ *  computed with AVX or SSE2 when the compiler targets them; like the filter kernels, the result is the same as
+ *  that of the plain loop as long as the compiler does not contract into FMA instructions (-ffp-contract=off).
+ */
+class ThresholdAdaptiveAlgorithm: public ThresholdAlgorithm
+{
+public:
+    enum Method { MEAN, SAUVOLA };
+    inline explicit ThresholdAdaptiveAlgorithm(int blockSize = 31, Method method = MEAN, double delta = 10,
+                                               double k = 0.2)
+    : ThresholdAlgorithm(1), _blockSize(blockSize), _method(method), _delta(delta), _k(k) {
+        assert(_blockSize > 0 && _blockSize % 2 == 1);
+    }
+    inline int blockSize() const { return _blockSize; }
+    inline void blockSize(int blockSize) { assert(blockSize > 0 && blockSize % 2 == 1); _blockSize = blockSize; }
+    inline Method method() const { return _method; }
+    inline void method(Method method) { _method = method; }
+    inline double delta() const { return _delta; }
+    inline void delta(double delta) { _delta = delta; }
+    inline double k() const { return _k; }
+    inline void k(double k) { _k = k; }
+    using ThresholdAlgorithm::binaryImages;
+    inline void binaryImages(const cv::Mat &image, std::vector<cv::Mat> &binaryImages) const override;
+    inline void read(const cv::FileNode &node) override {
+        _blockSize = (int)node[NODE_BLOCK_SIZE];
+        _method = (std::string)node[NODE_METHOD] == ADAPTIVE_METHOD_SAUVOLA ? SAUVOLA : MEAN;
+        _delta = (double)node[NODE_DELTA];
+        _k = (double)node[NODE_K];
+        assert(_blockSize > 0 && _blockSize % 2 == 1);
+    };
+    inline void write(cv::FileStorage &storage) const override {
+        storage << NODE_TYPE << THRESHOLD_ALGORITHM_ADAPTIVE;
+        storage << NODE_BLOCK_SIZE << _blockSize;
+        storage << NODE_METHOD << (_method == SAUVOLA ? ADAPTIVE_METHOD_SAUVOLA : ADAPTIVE_METHOD_MEAN);
+        storage << NODE_DELTA << _delta;
+        storage << NODE_K << _k;
+    };
+private:
+    int _blockSize;
+    Method _method;
+    double _delta, _k;
+    inline double threshold(double sum, double squares, double area) const;
+    inline void thresholdRow(const uchar *pixels, uchar *binary, const double *sum, const double *squares, int cols,
+                             int rows) const;
+};
+
+void ThresholdAdaptiveAlgorithm::binaryImages(const cv::Mat &image, std::vector<cv::Mat> &binaryImages) const
+{
+    assert(image.type() == CV_8UC1);
+    binaryImages.resize(1);
+    auto &binary = binaryImages[0];
+    binary.create(image.size(), CV_8UC1);
+
+    // The sums of the pixels (and of their squares) in each column, over the rows of the block around the current
+    // row, and the integral of those sums along the row. Sums of 8-bit pixels are exact in doubles.
+    int r = _blockSize / 2, cols = image.cols;
+    bool squares = _method == SAUVOLA;
+    std::vector<double> columnSum(cols, 0), columnSquares(cols, 0), sum(cols + 1, 0), sumSquares(cols + 1, 0);
+    auto addRow = [&](int y, double sign) {
+        auto row = image.ptr<uchar>(y);
+        for (int x = 0; x < cols; x++)
+            columnSum[x] += sign * row[x];
+        if (squares)
+            for (int x = 0; x < cols; x++)
+                columnSquares[x] += sign * row[x] * row[x];
+    };
+    for (int y = 0; y < std::min(r, image.rows); y++)
+        addRow(y, 1);
+    for (int y = 0; y < image.rows; y++) {
+        if (y + r < image.rows)
+            addRow(y + r, 1);
+        if (y - r - 1 >= 0)
+            addRow(y - r - 1, -1);
+        for (int x = 0; x < cols; x++)
+            sum[x + 1] = sum[x] + columnSum[x];
+        if (squares)
+            for (int x = 0; x < cols; x++)
+                sumSquares[x + 1] = sumSquares[x] + columnSquares[x];
+        int rows = std::min(y + r, image.rows - 1) - std::max(y - r, 0) + 1;
+        thresholdRow(image.ptr<uchar>(y), binary.ptr<uchar>(y), sum.data(), sumSquares.data(), cols, rows);
+    }
+    //debug(binaryImages);
+}
+
+/*!
+ * The threshold for a block with the given sum of pixels, sum of squared pixels and number of pixels.
+ */
+double ThresholdAdaptiveAlgorithm::threshold(double sum, double squares, double area) const
+{
+    double mean = sum / area;
+    if (_method == MEAN)
+        return mean + _delta;
+    double stddev = std::sqrt(std::max(squares / area - mean * mean, 0.0));
+    return mean * (1 + _k * (stddev / 128 - 1));
+}
+
+/*!
+ * Thresholds one row, given the integrals along the row of the column sums (sum[x] is the sum of columns 0 up to
+ * x - 1) and the number of rows these cover. The blocks of the pixels away from the left and right border all
+ * have the same area, so these are done with vector instructions.
+ */
+void ThresholdAdaptiveAlgorithm::thresholdRow(const uchar *pixels, uchar *binary, const double *sum,
+                                              const double *squares, int cols, int rows) const
+{
+    int r = _blockSize / 2;
+    auto thresholdPixel = [&](int x) {
+        int x0 = std::max(x - r, 0), x1 = std::min(x + r + 1, cols);
+        double t = threshold(sum[x1] - sum[x0], squares[x1] - squares[x0], (double)(x1 - x0) * rows);
+        binary[x] = pixels[x] > t ? 255 : 0;
+    };
+
+    int x = 0;
+    for (; x < std::min(r, cols); x++)
+        thresholdPixel(x);
+    int end = cols - r;
+    double area = (double)_blockSize * rows;
+#if defined(__AVX__)
+    auto varea = _mm256_set1_pd(area), delta = _mm256_set1_pd(_delta), k = _mm256_set1_pd(_k);
+    auto zero = _mm256_setzero_pd(), one = _mm256_set1_pd(1), range = _mm256_set1_pd(128);
+    for (; x + 4 <= end; x += 4) {
+        auto mean = _mm256_div_pd(_mm256_sub_pd(_mm256_loadu_pd(sum + x + r + 1), _mm256_loadu_pd(sum + x - r)),
+                                  varea);
+        __m256d t;
+        if (_method == MEAN)
+            t = _mm256_add_pd(mean, delta);
+        else {
+            auto q = _mm256_sub_pd(_mm256_loadu_pd(squares + x + r + 1), _mm256_loadu_pd(squares + x - r));
+            auto variance = _mm256_sub_pd(_mm256_div_pd(q, varea), _mm256_mul_pd(mean, mean));
+            auto stddev = _mm256_sqrt_pd(_mm256_max_pd(variance, zero));
+            t = _mm256_mul_pd(mean, _mm256_add_pd(one, _mm256_mul_pd(k, _mm256_sub_pd(_mm256_div_pd(stddev, range),
+                                                                                      one))));
+        }
+        int32_t four;
+        std::memcpy(&four, pixels + x, sizeof(four));
+        auto p = _mm256_cvtepi32_pd(_mm_cvtepu8_epi32(_mm_cvtsi32_si128(four)));
+        int above = _mm256_movemask_pd(_mm256_cmp_pd(p, t, _CMP_GT_OQ));
+        for (int j = 0; j < 4; j++)
+            binary[x + j] = (above >> j) & 1 ? 255 : 0;
+    }
+#elif defined(__SSE2__)
+    auto varea = _mm_set1_pd(area), delta = _mm_set1_pd(_delta), k = _mm_set1_pd(_k);
+    auto zero = _mm_setzero_pd(), one = _mm_set1_pd(1), range = _mm_set1_pd(128);
+    for (; x + 2 <= end; x += 2) {
+        auto mean = _mm_div_pd(_mm_sub_pd(_mm_loadu_pd(sum + x + r + 1), _mm_loadu_pd(sum + x - r)), varea);
+        __m128d t;
+        if (_method == MEAN)
+            t = _mm_add_pd(mean, delta);
+        else {
+            auto q = _mm_sub_pd(_mm_loadu_pd(squares + x + r + 1), _mm_loadu_pd(squares + x - r));
+            auto variance = _mm_sub_pd(_mm_div_pd(q, varea), _mm_mul_pd(mean, mean));
+            auto stddev = _mm_sqrt_pd(_mm_max_pd(variance, zero));
+            t = _mm_mul_pd(mean, _mm_add_pd(one, _mm_mul_pd(k, _mm_sub_pd(_mm_div_pd(stddev, range), one))));
+        }
+        int above = _mm_movemask_pd(_mm_cmpgt_pd(_mm_set_pd(pixels[x + 1], pixels[x]), t));
+        binary[x] = above & 1 ? 255 : 0;
+        binary[x + 1] = above & 2 ? 255 : 0;
+    }
+#endif
+    for (; x < cols; x++)
+        thresholdPixel(x);
+}
+
 #endif //OBJECTDETECTOR_THRESHOLDALGORITHM_HPP
@@ -0,0 +1,147 @@
+/* ============================================================================================== */
+/* WorkerPool.hpp                                                                                 */
+/*                                                                                                */
+/* This file is part of ObjectDetector (github.com/joostvanstuijvenberg/ObjectDetector.git)       */
+/*                                                                                                */
+/* Joost van Stuijvenberg                                                                         */
+/* ============================================================================================== */
+
+#ifndef OBJECTDETECTOR_WORKERPOOL_HPP
+#define OBJECTDETECTOR_WORKERPOOL_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <exception>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/* ---------------------------------------------------------------------------------------------- */
+/* Worker pool                                                                                    */
+/*                                                                                                */
+/* Distributes the items of a task over a number of workers: the calling thread, which is worker  */
+/* 0, and threads of the pool. The threads are started when first needed and then wait for the    */
+/* next task, so that repeated tasks (e.g. the levels of every frame) do not start and join       */
+/* threads each time. A pool runs one task at a time; it belongs to a single calling thread, like */
+/* the detection context that holds it.                                                           */
+/* ---------------------------------------------------------------------------------------------- */
+class WorkerPool {
+public:
+    inline WorkerPool() = default;
+    inline ~WorkerPool();
+    WorkerPool(const WorkerPool &) = delete;
+    WorkerPool &operator=(const WorkerPool &) = delete;
+    inline size_t threads() const { return _threads.size(); }
+    template<typename F> inline void run(size_t workers, size_t count, F process);
+private:
+    std::vector<std::thread> _threads;
+    std::mutex _mutex;
+    std::condition_variable _start, _done;
+    // The current task: invoke(task, worker) makes a worker process items until none are left.
+    void (*_invoke)(void *, size_t) = nullptr;
+    void *_task = nullptr;
+    size_t _generation = 0;
+    size_t _participants = 0;
+    size_t _pending = 0;
+    bool _stopping = false;
+    inline void loop(size_t worker, size_t generation);
+};
+
+/* ---------------------------------------------------------------------------------------------- */
+WorkerPool::~WorkerPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _stopping = true;
+    }
+    _start.notify_all();
+    for (auto &thread : _threads)
+        thread.join();
+}
+
+/* ---------------------------------------------------------------------------------------------- */
+/* Calls process(i, worker) for every item i below count, on the given number of workers; worker  */
+/* is the index of the worker. Each worker repeatedly claims the next unprocessed item. Returns   */
+/* when all items have been processed, and rethrows the first exception a worker ran into.        */
+/* ---------------------------------------------------------------------------------------------- */
+template<typename F>
+void WorkerPool::run(size_t workers, size_t count, F process)
+{
+    workers = std::min(workers, count);
+    if (workers <= 1) {
+        for (size_t i = 0; i < count; i++)
+            process(i, 0);
+        return;
+    }
+    // Only this thread changes the generation, so it can be read without the lock. A new thread must not
+    // take the last task, which has already been done, for a new one.
+    while (_threads.size() < workers - 1) {
+        size_t worker = _threads.size() + 1, generation = _generation;
+        _threads.emplace_back([this, worker, generation]() { loop(worker, generation); });
+    }
+
+    struct Task
+    {
+        F &process;
+        size_t count;
+        std::atomic<size_t> next;
+        std::mutex mutex;
+        std::exception_ptr error;
+    } task{process, count, {0}, {}, nullptr};
+    auto invoke = [](void *t, size_t worker) {
+        auto &task = *static_cast<Task *>(t);
+        try {
+            for (size_t i = task.next++; i < task.count; i = task.next++)
+                task.process(i, worker);
+        } catch (...) {
+            std::lock_guard<std::mutex> lock(task.mutex);
+            if (!task.error)
+                task.error = std::current_exception();
+        }
+    };
+
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _invoke = invoke;
+        _task = &task;
+        _participants = workers - 1;
+        _pending = workers - 1;
+        _generation++;
+    }
+    _start.notify_all();
+    invoke(&task, 0);
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+        _done.wait(lock, [this]() { return _pending == 0; });
+    }
+    if (task.error)
+        std::rethrow_exception(task.error);
+}
+
+/* ---------------------------------------------------------------------------------------------- */
+/* The loop of a pool thread: waits for a task that needs it, and works on it. generation is the  */
+/* generation of the last task that was started before the thread.                                */
+/* ---------------------------------------------------------------------------------------------- */
+void WorkerPool::loop(size_t worker, size_t generation)
+{
+    size_t seen = generation;
+    std::unique_lock<std::mutex> lock(_mutex);
+    for (;;) {
+        _start.wait(lock, [&]() { return _stopping || _generation != seen; });
+        if (_stopping)
+            return;
+        seen = _generation;
+        if (worker > _participants)
+            continue;
+        auto invoke = _invoke;
+        auto task = _task;
+        lock.unlock();
+        invoke(task, worker);
+        lock.lock();
+        if (--_pending == 0)
+            _done.notify_one();
+    }
+}
+
+#endif //OBJECTDETECTOR_WORKERPOOL_HPP
@@ -0,0 +1,213 @@
+/* ============================================================================================== */
+/* batch.cpp                                                                                      */
+/*                                                                                                */
+/* This file contains a command line tool that detects objects in a large number of images,       */
+/* without the need for a display. The detector is loaded from an xml file (see parameters.xml)   */
+/* and shared by a number of worker threads, which are fed by decoding threads through a          */
+/* pipeline. The keypoints are written as JSON lines or as compact binary records.                */
+/*                                                                                                */
+/* Joost van Stuijvenberg                                                                         */
+/* ============================================================================================== */
+
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "opencv2/opencv.hpp"
+
+#include "DetectionPipeline.hpp"
+#include "ObjectDetector.hpp"
+
+/* ---------------------------------------------------------------------------------------------- */
+/* usage()                                                                                        */
+/* ---------------------------------------------------------------------------------------------- */
+void usage() {
+    std::cerr << "Usage: ObjectDetectorBatch [-j threads] [-d threads] [-q capacity] [-b] [-o output] parameters.xml "
+                 "{directory | @filelist}" << std::endl;
+    std::cerr << "  -j threads  number of detection threads (default: number of cores)" << std::endl;
+    std::cerr << "  -d threads  number of decoding threads (default: half the number of cores)" << std::endl;
+    std::cerr << "  -q capacity number of images that may wait between the stages (default: 4 per thread)"
+              << std::endl;
+    std::cerr << "  -b          write binary records instead of JSON lines" << std::endl;
+    std::cerr << "  -o output   write to the given file instead of stdout" << std::endl;
+    exit(EXIT_FAILURE);
+}
+
+/* ---------------------------------------------------------------------------------------------- */
+/* imageFiles() - the files in a directory, or the files listed in a file (one per line) when the */
+/* argument starts with @.                                                                        */
+/* ---------------------------------------------------------------------------------------------- */
+std::vector<std::string> imageFiles(const std::string &source) {
+    std::vector<std::string> files;
+    if (source.size() > 1 && source[0] == '@') {
+        std::ifstream list(source.substr(1));
+        if (!list) {
+            std::cerr << "Could not open file list " << source.substr(1) << std::endl;
+            exit(EXIT_FAILURE);
+        }
+        std::string line;
+        while (std::getline(list, line))
+            if (!line.empty())
+                files.push_back(line);
+    } else {
+        std::vector<cv::String> found;
+        cv::glob(source, found, false);
+        files.assign(found.begin(), found.end());
+    }
+    return files;
+}
+
+/* ---------------------------------------------------------------------------------------------- */
+/* Appends a value to a binary record in the machine's byte order.                                */
+/* ---------------------------------------------------------------------------------------------- */
+template<typename T>
+void append(std::string &record, T value) {
+    char bytes[sizeof(T)];
+    std::memcpy(bytes, &value, sizeof(T));
+    record.append(bytes, sizeof(T));
+}
+
+/* ---------------------------------------------------------------------------------------------- */
+/* Binary record: uint64 index of the file, uint32 number of keypoints, followed by x, y and size */
+/* of each keypoint as float32.                                                                   */
+/* ---------------------------------------------------------------------------------------------- */
+void binaryRecord(std::string &record, uint64_t index, const std::vector<cv::KeyPoint> &keypoints) {
+    record.clear();
+    append(record, index);
+    append(record, (uint32_t)keypoints.size());
+    for (auto &kp : keypoints) {
+        append(record, kp.pt.x);
+        append(record, kp.pt.y);
+        append(record, kp.size);
+    }
+}
+
+/* ---------------------------------------------------------------------------------------------- */
+/* JSON record: {"index":0,"file":"...","keypoints":[[x,y,size],...]} followed by a newline.       */
+/* ---------------------------------------------------------------------------------------------- */
+void jsonRecord(std::ostringstream &record, uint64_t index, const std::string &file,
+                const std::vector<cv::KeyPoint> &keypoints) {
+    record.str("");
+    record << "{\"index\":" << index << ",\"file\":\"";
+    for (auto c : file) {
+        if (c == '"' || c == '\\')
+            record << '\\';
+        record << c;
+    }
+    record << "\",\"keypoints\":[";
+    for (size_t i = 0; i < keypoints.size(); i++)
+        record << (i == 0 ? "[" : ",[") << keypoints[i].pt.x << "," << keypoints[i].pt.y << ","
+               << keypoints[i].size << "]";
+    record << "]}\n";
+}
+
+/* ---------------------------------------------------------------------------------------------- */
+/* Prints the statistics of one stage of the pipeline.                                            */
+/* ---------------------------------------------------------------------------------------------- */
+void printStage(const std::string &name, const PipelineStageStatistics &stage) {
+    std::cerr << std::setw(8) << name << std::setw(9) << stage.workers << std::setw(9) << stage.items
+              << std::fixed << std::setprecision(2) << std::setw(10) << stage.busySeconds << std::setw(10)
+              << stage.waitSeconds << std::setw(12) << std::setprecision(0) << stage.utilisation * 100 << "%"
+              << std::endl;
+}
+
+/* ---------------------------------------------------------------------------------------------- */
+/* main()                                                                                         */
+/* ---------------------------------------------------------------------------------------------- */
+int main(int argc, char **argv) {
+    size_t threads = std::max(1u, std::thread::hardware_concurrency());
+    size_t decoders = std::max(1u, std::thread::hardware_concurrency() / 2);
+    size_t capacity = 0;
+    bool binary = false;
+    std::string outputFile;
+    std::vector<std::string> arguments;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "-j" && i + 1 < argc)
+            threads = std::max<size_t>(1, std::stoul(argv[++i]));
+        else if (arg == "-d" && i + 1 < argc)
+            decoders = std::max<size_t>(1, std::stoul(argv[++i]));
+        else if (arg == "-q" && i + 1 < argc)
+            capacity = std::max<size_t>(1, std::stoul(argv[++i]));
+        else if (arg == "-b")
+            binary = true;
+        else if (arg == "-o" && i + 1 < argc)
+            outputFile = argv[++i];
+        else if (arg.size() > 1 && arg[0] == '-')
+            usage();
+        else
+            arguments.push_back(arg);
+    }
+    if (arguments.size() != 2)
+        usage();
+
+    // Load the detector. It is not changed while detecting, so all workers can share it.
+    cv::FileStorage storage(arguments[0], cv::FileStorage::READ);
+    if (!storage.isOpened()) {
+        std::cerr << "Could not open parameters " << arguments[0] << std::endl;
+        exit(EXIT_FAILURE);
+    }
+    auto od = std::make_shared<ObjectDetector>();
+    od->read(storage.root());
+
+    auto files = imageFiles(arguments[1]);
+
+    std::ofstream file;
+    if (!outputFile.empty()) {
+        file.open(outputFile, binary ? std::ios::binary | std::ios::trunc : std::ios::trunc);
+        if (!file) {
+            std::cerr << "Could not open output " << outputFile << std::endl;
+            exit(EXIT_FAILURE);
+        }
+    }
+    std::ios::sync_with_stdio(false);
+    std::ostream &output = outputFile.empty() ? std::cout : file;
+
+    // The files are decoded, searched and written in a pipeline, so that reading the next images
+    // overlaps with detection. Records are written in the order in which the files complete; the
+    // index refers to the position of the file in the list.
+    DetectionPipeline pipeline(od);
+    pipeline.decodeWorkers((unsigned int)decoders);
+    pipeline.detectWorkers((unsigned int)threads);
+    pipeline.queueCapacity(capacity > 0 ? capacity : 4 * threads);
+    std::mutex errorMutex;
+    std::string record;
+    std::ostringstream json;
+    pipeline.run(files.size(), [&](size_t i, cv::Mat &image) {
+        image = cv::imread(files[i], cv::IMREAD_GRAYSCALE);
+        if (image.data == nullptr) {
+            std::lock_guard<std::mutex> lock(errorMutex);
+            std::cerr << "Could not load file " << files[i] << std::endl;
+            return false;
+        }
+        return true;
+    }, [&](size_t i, const std::vector<cv::KeyPoint> &keypoints) {
+        if (binary)
+            binaryRecord(record, i, keypoints);
+        else {
+            jsonRecord(json, i, files[i], keypoints);
+            record = json.str();
+        }
+        output.write(record.data(), record.size());
+    });
+    output.flush();
+
+    auto &statistics = pipeline.statistics();
+    std::cerr << files.size() - statistics.failed << " of " << files.size() << " files processed in "
+              << std::fixed << std::setprecision(2) << statistics.seconds << " s" << std::endl;
+    std::cerr << std::setw(8) << "stage" << std::setw(9) << "threads" << std::setw(9) << "images"
+              << std::setw(10) << "busy (s)" << std::setw(10) << "wait (s)" << std::setw(13) << "utilisation"
+              << std::endl;
+    printStage("decode", statistics.decode);
+    printStage("detect", statistics.detect);
+    printStage("write", statistics.sink);
+    return statistics.failed == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,806 @@
+/* ============================================================================================== */
+/* benchmark.cpp                                                                                  */
+/*                                                                                                */
+/* This file contains benchmarks for ObjectDetector. It does not need a display and is meant to   */
+/* be run from the command line.                                                                  */
+/*                                                                                                */
+/* Joost van Stuijvenberg                                                                         */
+/* ============================================================================================== */
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "opencv2/opencv.hpp"
+
+#include "CenterGrouping.hpp"
+#include "MappedFrames.hpp"
+#include "ObjectDetector.hpp"
+#include "StaticObjectDetector.hpp"
+#include "StreamDetector.hpp"
+#include "Synthetic.hpp"
+
+/* ---------------------------------------------------------------------------------------------- */
+/* Counts all allocations made with new, by replacing the global operators. Image data is not     */
+/* allocated with new by OpenCV; the detector's trace counts those allocations instead.           */
+/* ---------------------------------------------------------------------------------------------- */
+static std::atomic<size_t> allocations(0), allocatedBytes(0);
+
+void *operator new(std::size_t size) {
+    allocations++;
+    allocatedBytes += size;
+    if (void *p = std::malloc(size == 0 ? 1 : size))
+        return p;
+    throw std::bad_alloc();
+}
+
+void operator delete(void *p) noexcept { std::free(p); }
+void operator delete(void *p, std::size_t) noexcept { std::free(p); }
+
+/* ---------------------------------------------------------------------------------------------- */
+template<typename F>
+double milliseconds(F f) {
+    auto start = std::chrono::steady_clock::now();
+    f();
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+/* ---------------------------------------------------------------------------------------------- */
+/* benchmarkGrouping() - compares the naive and grid-based grouping of centers for 10 to 100k     */
+/* blobs. The naive version is skipped when it would take too long. Returns false when the two    */
+/* groupings differ.                                                                              */
+/* ---------------------------------------------------------------------------------------------- */
+bool benchmarkGrouping() {
+    const size_t levels = 12;
+    const double minDist = 10.0;
+    std::mt19937 rng(42);
+    bool passed = true;
+
+    std::cout << "Grouping of centers over " << levels << " levels" << std::endl;
+    std::cout << std::setw(10) << "blobs" << std::setw(14) << "naive (ms)" << std::setw(14) << "grid (ms)"
+              << std::setw(10) << "equal" << std::endl;
+    for (size_t blobs : {10, 100, 1000, 10000, 100000}) {
+        auto input = blobLevels(blobs, levels, rng);
+
+        std::vector<std::vector<Center>> grid;
+        double gridTime = milliseconds([&]() {
+            CenterGrouping grouping(minDist);
+            for (auto &level : input)
+                grouping.addLevel(level);
+            grid = grouping.groups();
+        });
+
+        std::cout << std::setw(10) << blobs;
+        if (blobs <= 10000) {
+            std::vector<std::vector<Center>> naive;
+            double naiveTime = milliseconds([&]() { naive = groupNaive(input, minDist); });
+            bool same = sameGroups(naive, grid);
+            passed = same && passed;
+            std::cout << std::setw(14) << std::fixed << std::setprecision(2) << naiveTime
+                      << std::setw(14) << gridTime << std::setw(10) << (same ? "yes" : "NO");
+        } else
+            std::cout << std::setw(14) << "-" << std::setw(14) << std::fixed << std::setprecision(2) << gridTime
+                      << std::setw(10) << "-";
+        std::cout << std::endl;
+    }
+    return passed;
+}
+
+/* ---------------------------------------------------------------------------------------------- */
+/* residentMemory() - the resident set size of this process in bytes, or 0 when unknown.          */
+/* ---------------------------------------------------------------------------------------------- */
+size_t residentMemory() {
+    std::ifstream statm("/proc/self/statm");
+    size_t pages = 0, resident = 0;
+    if (!(statm >> pages >> resident))
+        return 0;
+    return resident * 4096;
+}
+
+/* ---------------------------------------------------------------------------------------------- */
+/* benchmarkMemory() - runs detect() on the same image for the given number of frames and reports */
+/* the resident memory and the number of allocations per frame along the way. Both should stay    */
+/* flat once the buffers have been allocated, and the allocations should drop well below those of */
+/* the first frame, which still has to allocate all buffers. The second run converts and          */
+/* thresholds color frames in a single pass, alternating between two frames of which one leaves   */
+/* out more threshold levels than the other; image data should then not be allocated either.      */
+/* ---------------------------------------------------------------------------------------------- */
+void benchmarkMemory(size_t frames) {
+    cv::Mat image(1080, 1920, CV_8UC1, cv::Scalar(30));
+    std::mt19937 rng(42);
+    std::uniform_int_distribution<int> x(0, image.cols - 1), y(0, image.rows - 1), r(4, 20), gray(60, 220);
+    for (int i = 0; i < 2000; i++)
+        cv::circle(image, cv::Point(x(rng), y(rng)), r(rng), cv::Scalar(gray(rng)), -1);
+
+    // The second color frame has no pixels above 100, so that all levels above it are left out.
+    cv::Mat colorFrames[2], dim;
+    cvtColor(image, colorFrames[0], cv::COLOR_GRAY2BGR);
+    cv::min(image, 100, dim);
+    cvtColor(dim, colorFrames[1], cv::COLOR_GRAY2BGR);
+
+    ObjectDetector od;
+    od.setThresholdAlgorithm(std::make_shared<ThresholdRangeAlgorithm>(40, 150, 10, 3));
+    od.addFilter(std::make_shared<AreaFilter>(20, 5000));
+    od.instrumentation(true);
+
+    for (int color = 0; color < 2; color++) {
+        std::cout << "Resident memory while detecting in " << frames << (color ? " color" : "") << " frames of "
+                  << image.cols << " x " << image.rows << std::endl;
+        std::cout << std::setw(10) << "frame" << std::setw(14) << "memory (kB)" << std::setw(20)
+                  << "allocations/frame" << std::setw(14) << "image allocs" << std::endl;
+        size_t report = std::max<size_t>(frames / 10, 1);
+        size_t reported = 0, startAllocations = allocations, imageAllocations = 0;
+        for (size_t frame = 1; frame <= frames; frame++) {
+            od.detect(color ? colorFrames[frame % 2] : image);
+            imageAllocations += od.trace().imageAllocations;
+            if (frame == 1 || frame % report == 0) {
+                std::cout << std::setw(10) << frame << std::setw(14) << residentMemory() / 1024 << std::setw(20)
+                          << (allocations - startAllocations) / (frame - reported) << std::setw(14)
+                          << imageAllocations << std::endl;
+                reported = frame;
+                startAllocations = allocations;
+                imageAllocations = 0;
+            }
+        }
+    }
+}
+
+/* ---------------------------------------------------------------------------------------------- */
+/* A named threshold algorithm or filter, to build the benchmark configurations from.             */
+/* ---------------------------------------------------------------------------------------------- */
+template<typename T>
+struct Named
+{
+    std::string name;
+    std::shared_ptr<T> object;
+};
+
+/* ---------------------------------------------------------------------------------------------- */
+/* benchmarkDetection() - times detect() on synthetic images for every threshold algorithm and    */
+/* every combination of filters. The results are printed as a table and, when a file name is      */
+/* given, appended to that file as one JSON object per line, to compare different versions.       */
+/* ---------------------------------------------------------------------------------------------- */
+void benchmarkDetection(size_t frames, const std::string &resultsFile) {
+    std::vector<std::pair<std::string, BlobField>> scenes(2);
+    scenes[0].first = "vga";
+    scenes[0].second.width = 640;
+    scenes[0].second.height = 480;
+    scenes[0].second.blobs = 150;
+    scenes[0].second.noise = 0;
+    scenes[1].first = "hd";
+
+    std::vector<Named<ThresholdAlgorithm>> algorithms = {
+            {"fixed", std::make_shared<ThresholdFixedAlgorithm>(128)},
+            {"range", std::make_shared<ThresholdRangeAlgorithm>(40, 220, 10, 2)},
+            {"otsu", std::make_shared<ThresholdOtsuAlgorithm>()},
+            {"componentTree", std::make_shared<ThresholdComponentTreeAlgorithm>(40, 220, 10, 2)},
+            {"adaptive", std::make_shared<ThresholdAdaptiveAlgorithm>(51, ThresholdAdaptiveAlgorithm::MEAN, 15)}};
+    std::vector<Named<Filter>> filters = {
+            {"area", std::make_shared<AreaFilter>(20, 5000)},
+            {"circularity", std::make_shared<CircularityFilter>(0.7, 1.2)},
+            {"convexity", std::make_shared<ConvexityFilter>(0.9, 1.1)},
+            {"inertia", std::make_shared<InertiaFilter>(0.5, 1.1)},
+            {"color", std::make_shared<ColorFilter>(100, 255)},
+            {"extent", std::make_shared<ExtentFilter>(0.5, 1.1)}};
+
+    std::ofstream results;
+    if (!resultsFile.empty())
+        results.open(resultsFile, std::ios::app);
+
+    std::cout << "Detection in " << frames << " frames per configuration" << std::endl;
+    std::cout << std::setw(6) << "scene" << std::setw(15) << "algorithm" << std::setw(45) << "filters"
+              << std::setw(10) << "fps" << std::setw(10) << "MP/s" << std::setw(14) << "grouping (ms)"
+              << std::setw(14) << "allocs/frame" << std::setw(12) << "keypoints" << std::endl;
+    for (auto &scene : scenes) {
+        auto image = generateBlobField(scene.second);
+        double megapixels = image.total() / 1e6;
+        for (auto &algorithm : algorithms)
+            for (size_t mask = 0; mask < (1u << filters.size()); mask++) {
+                ObjectDetector od;
+                od.setThresholdAlgorithm(algorithm.object);
+                od.instrumentation(true);
+                std::string names;
+                for (size_t f = 0; f < filters.size(); f++)
+                    if (mask & (1u << f)) {
+                        od.addFilter(filters[f].object);
+                        names += (names.empty() ? "" : "+") + filters[f].name;
+                    }
+                if (names.empty())
+                    names = "none";
+
+                // The first frame allocates the buffers; it is not part of the measurement.
+                size_t keypoints = od.detect(image).size();
+                double grouping = 0;
+                size_t imageAllocations = 0;
+                size_t startAllocations = allocations, startBytes = allocatedBytes;
+                double time = milliseconds([&]() {
+                    for (size_t frame = 0; frame < frames; frame++) {
+                        od.detect(image);
+                        grouping += od.trace().seconds[STAGE_GROUPING] * 1000.0;
+                        imageAllocations += od.trace().imageAllocations;
+                    }
+                });
+                double fps = frames * 1000.0 / time;
+                double allocationsPerFrame = (double)(allocations - startAllocations) / frames;
+                double bytesPerFrame = (double)(allocatedBytes - startBytes) / frames;
+
+                std::cout << std::setw(6) << scene.first << std::setw(15) << algorithm.name << std::setw(45) << names
+                          << std::fixed << std::setprecision(1) << std::setw(10) << fps
+                          << std::setw(10) << fps * megapixels << std::setprecision(3)
+                          << std::setw(14) << grouping / frames << std::setprecision(0)
+                          << std::setw(14) << allocationsPerFrame << std::setw(12) << keypoints << std::endl;
+                if (results.is_open())
+                    results << "{\"scene\":\"" << scene.first << "\",\"width\":" << image.cols
+                            << ",\"height\":" << image.rows << ",\"blobs\":" << scene.second.blobs
+                            << ",\"noise\":" << scene.second.noise << ",\"algorithm\":\"" << algorithm.name
+                            << "\",\"filters\":\"" << names << "\",\"frames\":" << frames
+                            << std::setprecision(6) << ",\"fps\":" << fps << ",\"megapixelsPerSecond\":"
+                            << fps * megapixels << ",\"groupingMilliseconds\":" << grouping / frames
+                            << ",\"allocationsPerFrame\":" << allocationsPerFrame << ",\"bytesPerFrame\":"
+                            << bytesPerFrame << ",\"imageAllocationsPerFrame\":"
+                            << (double)imageAllocations / frames << ",\"keypoints\":" << keypoints << "}"
+                            << std::endl;
+            }
+    }
+}
+
+/* ---------------------------------------------------------------------------------------------- */
+/* matchedKeypoints() - the number of reference keypoints for which there is a keypoint within    */
+/* the given distance.                                                                            */
+/* ---------------------------------------------------------------------------------------------- */
+size_t matchedKeypoints(const std::vector<cv::KeyPoint> &reference, const std::vector<cv::KeyPoint> &keypoints,
+                        double maxDist) {
+    size_t matched = 0;
+    for (auto &r : reference)
+        for (auto &k : keypoints)
+            if (cv::norm(r.pt - k.pt) <= maxDist) {
+                matched++;
+                break;
+            }
+    return matched;
+}
+
+/* ---------------------------------------------------------------------------------------------- */
+/* benchmarkPyramid() - compares detection at full resolution with coarse-to-fine detection for   */
+/* 1 to 3 pyramid levels, in objects.png (when it can be loaded) and in synthetic scenes. Recall  */
+/* is the share of the full resolution keypoints that is found again, within 2 pixels; precision  */
+/* is the share of the coarse-to-fine keypoints that matches a full resolution keypoint.          */
+/* ---------------------------------------------------------------------------------------------- */
+void benchmarkPyramid(size_t frames, const std::string &imageFile) {
+    std::vector<std::pair<std::string, cv::Mat>> scenes;
+    cv::Mat objects = cv::imread(imageFile);
+    if (objects.data != nullptr)
+        scenes.emplace_back(imageFile, objects);
+    BlobField sparse;
+    sparse.width = 3840;
+    sparse.height = 2160;
+    sparse.blobs = 200;
+    scenes.emplace_back("sparse 4k", generateBlobField(sparse));
+    BlobField dense;
+    dense.blobs = 3000;
+    scenes.emplace_back("dense hd", generateBlobField(dense));
+
+    std::cout << "Coarse-to-fine detection, " << frames << " frames per configuration" << std::endl;
+    std::cout << std::setw(12) << "scene" << std::setw(8) << "levels" << std::setw(12) << "ms/frame"
+              << std::setw(10) << "speedup" << std::setw(8) << "rois" << std::setw(12) << "keypoints"
+              << std::setw(10) << "recall" << std::setw(12) << "precision" << std::endl;
+    for (auto &scene : scenes) {
+        ObjectDetector od;
+        od.setThresholdAlgorithm(std::make_shared<ThresholdRangeAlgorithm>(40, 150, 10, 3));
+        od.addFilter(std::make_shared<AreaFilter>(100, 50000));
+        od.addFilter(std::make_shared<CircularityFilter>(0.6, 1.2));
+
+        std::vector<cv::KeyPoint> reference;
+        double fullTime = 0;
+        for (int levels = 0; levels <= 3; levels++) {
+            od.pyramidLevels(levels);
+            auto keypoints = od.detect(scene.second);
+            double time = milliseconds([&]() {
+                for (size_t frame = 0; frame < frames; frame++)
+                    od.detect(scene.second);
+            }) / frames;
+            if (levels == 0) {
+                reference = keypoints;
+                fullTime = time;
+            }
+            size_t matched = matchedKeypoints(reference, keypoints, 2.0);
+            size_t matching = matchedKeypoints(keypoints, reference, 2.0);
+            std::cout << std::setw(12) << scene.first << std::setw(8) << levels << std::fixed
+                      << std::setprecision(2) << std::setw(12) << time << std::setw(10) << fullTime / time
+                      << std::setw(8) << (levels == 0 ? 0 : od.regionsOfInterest().size())
+                      << std::setw(12) << keypoints.size()
+                      << std::setw(10) << (reference.empty() ? 1.0 : (double)matched / reference.size())
+                      << std::setw(12) << (keypoints.empty() ? 1.0 : (double)matching / keypoints.size())
+                      << std::endl;
+        }
+    }
+}
+
+/* ---------------------------------------------------------------------------------------------- */
+/* benchmarkStream() - compares detect() on every frame with the stream detector, for blobs that  */
+/* move a few pixels per frame across an HD frame (as on a conveyor). Also reports how many       */
+/* tracks were started; ideally that is the number of blobs that have been in view.               */
+/* ---------------------------------------------------------------------------------------------- */
+void benchmarkStream(size_t frames) {
+    const int blobs = 60;
+    std::mt19937 rng(42);
+    std::uniform_real_distribution<double> x(0, 1920), y(40, 1040), speed(2, 6), radius(8, 16);
+    struct Blob { cv::Point2d location; double radius, speed; };
+    std::vector<Blob> moving(blobs);
+    for (auto &blob : moving)
+        blob = Blob{cv::Point2d(x(rng), y(rng)), radius(rng), speed(rng)};
+
+    // Render all frames up front, so that only detection is timed.
+    std::vector<cv::Mat> video;
+    for (size_t frame = 0; frame < frames; frame++) {
+        cv::Mat image(1080, 1920, CV_8UC1, cv::Scalar(30));
+        for (auto &blob : moving) {
+            double bx = std::fmod(blob.location.x + blob.speed * frame, 1920.0 + 4 * blob.radius) - 2 * blob.radius;
+            cv::circle(image, cv::Point((int)bx, (int)blob.location.y), (int)blob.radius, cv::Scalar(200), -1);
+        }
+        video.push_back(image);
+    }
+
+    auto od = std::make_shared<ObjectDetector>();
+    od->setThresholdAlgorithm(std::make_shared<ThresholdRangeAlgorithm>(40, 150, 10, 3));
+    od->addFilter(std::make_shared<AreaFilter>(50, 5000));
+    StreamDetector sd(od);
+
+    size_t full = 0, streamed = 0;
+    double fullTime = milliseconds([&]() {
+        for (auto &image : video)
+            full += od->detect(image).size();
+    });
+    double streamTime = milliseconds([&]() {
+        for (auto &image : video)
+            streamed += sd.process(image).size();
+    });
+
+    int maxId = -1;
+    for (auto &track : sd.tracks())
+        maxId = std::max(maxId, track.id);
+    std::cout << "Detection in " << frames << " frames with " << blobs << " moving objects" << std::endl;
+    std::cout << std::setw(10) << "" << std::setw(12) << "ms/frame" << std::setw(16) << "keypoints/frame"
+              << std::endl;
+    std::cout << std::fixed << std::setprecision(2) << std::setw(10) << "detect" << std::setw(12)
+              << fullTime / frames << std::setw(16) << (double)full / frames << std::endl;
+    std::cout << std::setw(10) << "stream" << std::setw(12) << streamTime / frames << std::setw(16)
+              << (double)streamed / frames << std::endl;
+    std::cout << "Speedup " << fullTime / streamTime << ", " << maxId + 1 << " tracks started" << std::endl;
+}
+
+/* ---------------------------------------------------------------------------------------------- */
+/* benchmarkStatic() - compares the runtime configured ObjectDetector with a StaticObjectDetector */
+/* with the same threshold algorithm and filters, and checks that they find the same keypoints,   */
+/* also for an area filter only. Returns false when they do not.                                  */
+/* ---------------------------------------------------------------------------------------------- */
+bool benchmarkStatic(size_t frames) {
+    auto image = generateBlobField(BlobField());
+    ThresholdRangeAlgorithm algorithm(40, 220, 10, 2);
+    AreaFilter area(20, 5000);
+    CircularityFilter circularity(0.7, 1.2);
+    InertiaFilter inertia(0.5, 1.1);
+
+    ObjectDetector od;
+    od.setThresholdAlgorithm(std::make_shared<ThresholdRangeAlgorithm>(algorithm));
+    od.addFilter(std::make_shared<AreaFilter>(area));
+    od.addFilter(std::make_shared<CircularityFilter>(circularity));
+    od.addFilter(std::make_shared<InertiaFilter>(inertia));
+    StaticObjectDetector<ThresholdRangeAlgorithm, AreaFilter, CircularityFilter, InertiaFilter>
+            sod(algorithm, area, circularity, inertia);
+
+    auto expected = od.detect(image);
+    auto actual = sod.detect(image);
+    bool equal = expected.size() == actual.size();
+    for (size_t i = 0; equal && i < expected.size(); i++)
+        equal = expected[i].pt == actual[i].pt && expected[i].size == actual[i].size;
+
+    double runtime = milliseconds([&]() {
+        for (size_t frame = 0; frame < frames; frame++)
+            od.detect(image);
+    }) / frames;
+    double compiled = milliseconds([&]() {
+        for (size_t frame = 0; frame < frames; frame++)
+            sod.detect(image);
+    }) / frames;
+
+    std::cout << "Runtime versus compile-time filter chain (range, area, circularity, inertia), "
+              << frames << " frames" << std::endl;
+    std::cout << std::setw(16) << "" << std::setw(12) << "ms/frame" << std::endl;
+    std::cout << std::fixed << std::setprecision(2) << std::setw(16) << "ObjectDetector" << std::setw(12) << runtime
+              << std::endl;
+    std::cout << std::setw(16) << "Static" << std::setw(12) << compiled << std::endl;
+    std::cout << "Speedup " << runtime / compiled << ", same keypoints: " << (equal ? "yes" : "NO") << std::endl;
+
+    // A chain with only an area filter, which needs no contours; the keypoints must still be the same.
+    ObjectDetector areaOnly;
+    areaOnly.setThresholdAlgorithm(std::make_shared<ThresholdRangeAlgorithm>(algorithm));
+    areaOnly.addFilter(std::make_shared<AreaFilter>(area));
+    StaticObjectDetector<ThresholdRangeAlgorithm, AreaFilter> areaOnlyStatic(algorithm, area);
+    expected = areaOnly.detect(image);
+    actual = areaOnlyStatic.detect(image);
+    bool areaEqual = expected.size() == actual.size();
+    for (size_t i = 0; areaEqual && i < expected.size(); i++)
+        areaEqual = expected[i].pt == actual[i].pt && expected[i].size == actual[i].size;
+    std::cout << "Area filter only, same keypoints: " << (areaEqual ? "yes" : "NO") << std::endl;
+    return equal && areaEqual;
+}
+
+/* ---------------------------------------------------------------------------------------------- */
+/* benchmarkBatch() - compares filtering one contour at a time with batched filtering, for a      */
+/* scene with many small blobs, and checks that both find the same keypoints. Returns false when  */
+/* they do not.                                                                                   */
+/* ---------------------------------------------------------------------------------------------- */
+bool benchmarkBatch(size_t frames) {
+    BlobField field;
+    field.blobs = 40000;
+    field.minRadius = 2;
+    field.maxRadius = 6;
+    auto image = generateBlobField(field);
+
+    ObjectDetector od;
+    od.setThresholdAlgorithm(std::make_shared<ThresholdRangeAlgorithm>(40, 220, 10, 2));
+    od.addFilter(std::make_shared<AreaFilter>(10, 500));
+    od.addFilter(std::make_shared<CircularityFilter>(0.6, 1.2));
+    od.addFilter(std::make_shared<InertiaFilter>(0.4, 1.1));
+    od.instrumentation(true);
+
+    std::cout << "Filtering one contour at a time versus in batches, " << frames << " frames" << std::endl;
+    std::cout << std::setw(10) << "" << std::setw(12) << "ms/frame" << std::setw(14) << "filters (ms)"
+              << std::setw(12) << "contours" << std::setw(12) << "keypoints" << std::endl;
+    std::vector<cv::KeyPoint> reference;
+    bool passed = true;
+    for (bool batch : {false, true}) {
+        od.batchFilters(batch);
+        auto keypoints = od.detect(image);
+        double filters = 0;
+        size_t contours = 0;
+        double time = milliseconds([&]() {
+            for (size_t frame = 0; frame < frames; frame++) {
+                od.detect(image);
+                filters += od.trace().seconds[STAGE_FILTERS] * 1000.0;
+            }
+        });
+        for (auto c : od.trace().contours)
+            contours += c;
+        std::cout << std::setw(10) << (batch ? "batch" : "single") << std::fixed << std::setprecision(2)
+                  << std::setw(12) << time / frames << std::setw(14) << filters / frames << std::setw(12) << contours
+                  << std::setw(12) << keypoints.size() << std::endl;
+        if (!batch)
+            reference = keypoints;
+        else {
+            bool equal = reference.size() == keypoints.size();
+            for (size_t i = 0; equal && i < keypoints.size(); i++)
+                equal = reference[i].pt == keypoints[i].pt && reference[i].size == keypoints[i].size;
+            std::cout << "Same keypoints: " << (equal ? "yes" : "NO") << std::endl;
+            passed = equal;
+        }
+    }
+    return passed;
+}
+
+/* ---------------------------------------------------------------------------------------------- */
+/* benchmarkColor() - compares converting a 4K color image to grayscale before detect() with      */
+/* letting detect() convert and threshold it in a single pass, and checks that both find the same */
+/* keypoints. Returns false when they do not.                                                     */
+/* ---------------------------------------------------------------------------------------------- */
+bool benchmarkColor(size_t frames) {
+    BlobField field;
+    field.width = 3840;
+    field.height = 2160;
+    field.blobs = 4000;
+    cv::Mat color, gray;
+    cvtColor(generateBlobField(field), color, cv::COLOR_GRAY2BGR);
+
+    ObjectDetector od;
+    od.setThresholdAlgorithm(std::make_shared<ThresholdRangeAlgorithm>(40, 220, 10, 2));
+    od.addFilter(std::make_shared<AreaFilter>(20, 5000));
+
+    std::cout << "Grayscale conversion before detect() versus fused with thresholding, 4K BGR, " << frames
+              << " frames" << std::endl;
+    std::cout << std::setw(10) << "" << std::setw(12) << "ms/frame" << std::setw(12) << "keypoints" << std::endl;
+    std::vector<cv::KeyPoint> reference;
+    bool passed = true;
+    for (bool fused : {false, true}) {
+        auto detect = [&]() {
+            if (fused)
+                return od.detect(color);
+            cvtColor(color, gray, cv::COLOR_BGR2GRAY);
+            return od.detect(gray);
+        };
+        auto keypoints = detect();
+        double time = milliseconds([&]() {
+            for (size_t frame = 0; frame < frames; frame++)
+                detect();
+        });
+        std::cout << std::setw(10) << (fused ? "fused" : "separate") << std::fixed << std::setprecision(2)
+                  << std::setw(12) << time / frames << std::setw(12) << keypoints.size() << std::endl;
+        if (!fused)
+            reference = keypoints;
+        else {
+            bool equal = reference.size() == keypoints.size();
+            for (size_t i = 0; equal && i < keypoints.size(); i++)
+                equal = reference[i].pt == keypoints[i].pt && reference[i].size == keypoints[i].size;
+            std::cout << "Same keypoints: " << (equal ? "yes" : "NO") << std::endl;
+            passed = equal;
+        }
+    }
+    return passed;
+}
+
+/* ---------------------------------------------------------------------------------------------- */
+/* benchmarkRunLength() - compares storing the threshold levels as 8-bit images with storing them */
+/* run-length encoded and labeling the runs: the memory the levels take, the time per frame and   */
+/* the keypoints. The component tree finds the same regions in a single pass over the image.      */
+/* Returns false when the keypoints of the run-length levels differ from those of the tree.       */
+/* ---------------------------------------------------------------------------------------------- */
+bool benchmarkRunLength(size_t frames) {
+    auto image = generateBlobField(BlobField());
+    ThresholdRangeAlgorithm algorithm(40, 220, 10, 2);
+    ObjectDetector od;
+    od.addFilter(std::make_shared<AreaFilter>(20, 5000));
+    od.addFilter(std::make_shared<CircularityFilter>(0.7, 1.2));
+
+    std::vector<cv::Mat> binaryImages;
+    std::vector<RunLengthImage> runLengthImages;
+    std::vector<int> levelCounts;
+    algorithm.binaryImages(image, binaryImages, levelCounts);
+    algorithm.runLengthImages(image, runLengthImages, levelCounts);
+    size_t runLengthBytes = 0;
+    for (auto &level : runLengthImages)
+        runLengthBytes += level.bytes();
+
+    std::cout << "Threshold levels as 8-bit images versus run-length encoded, " << binaryImages.size() << " levels, "
+              << frames << " frames" << std::endl;
+    std::cout << std::setw(12) << "" << std::setw(12) << "ms/frame" << std::setw(14) << "level bytes"
+              << std::setw(12) << "keypoints" << std::endl;
+    const char *names[] = {"8-bit", "tree", "run-length"};
+    std::string bytes[] = {std::to_string(binaryImages.size() * image.total()), "-", std::to_string(runLengthBytes)};
+    std::vector<cv::KeyPoint> tree;
+    bool passed = true;
+    for (int i = 0; i < 3; i++) {
+        if (i == 1)
+            od.setThresholdAlgorithm(std::make_shared<ThresholdComponentTreeAlgorithm>(40, 220, 10, 2));
+        else
+            od.setThresholdAlgorithm(std::make_shared<ThresholdRangeAlgorithm>(algorithm));
+        od.runLengthLevels(i == 2);
+        auto keypoints = od.detect(image);
+        double time = milliseconds([&]() {
+            for (size_t frame = 0; frame < frames; frame++)
+                od.detect(image);
+        });
+        std::cout << std::setw(12) << names[i] << std::fixed << std::setprecision(2) << std::setw(12)
+                  << time / frames << std::setw(14) << bytes[i] << std::setw(12) << keypoints.size() << std::endl;
+        if (i == 1)
+            tree = keypoints;
+        else if (i == 2) {
+            passed = sameKeypointSets(tree, keypoints, 1e-3);
+            std::cout << "Same keypoints as the tree: " << (passed ? "yes" : "NO") << std::endl;
+        }
+    }
+    return passed;
+}
+
+/* ---------------------------------------------------------------------------------------------- */
+/* benchmarkRadius() - times locating the objects of a level: sorting all distances to the        */
+/* contour points, as before, versus selecting the median with the SIMD distance kernel, in       */
+/* double and in single precision, and reports how far the radii are from the sorted ones.        */
+/* ---------------------------------------------------------------------------------------------- */
+void benchmarkRadius(size_t frames) {
+    BlobField field;
+    field.maxRadius = 60;
+    cv::Mat image = generateBlobField(field), binaryImage;
+    threshold(image, binaryImage, 100, 255, cv::THRESH_BINARY);
+    std::vector<std::vector<cv::Point>> contours;
+    findContours(binaryImage, contours, cv::RETR_LIST, cv::CHAIN_APPROX_SIMPLE);
+    // The features refer to the moments, which must therefore stay where they are.
+    std::vector<cv::Moments> contourMoments;
+    contourMoments.reserve(contours.size());
+    std::vector<ContourFeatures> features;
+    for (auto &contour : contours) {
+        contourMoments.push_back(moments(cv::Mat(contour), true));
+        if (contourMoments.back().m00 != 0.0)
+            features.emplace_back(image, binaryImage, contour, contourMoments.back(), nullptr);
+    }
+
+    std::cout << "Median radius by sorting versus selection, " << features.size() << " contours, " << frames
+              << " frames" << std::endl;
+    std::cout << std::setw(10) << "" << std::setw(12) << "ms/frame" << std::setw(16) << "max difference"
+              << std::endl;
+    std::vector<double> reference(features.size()), doubles;
+    std::vector<float> floats;
+    for (int method = 0; method < 3; method++) {
+        std::vector<double> radii(features.size());
+        auto locate = [&]() {
+            for (size_t i = 0; i < features.size(); i++) {
+                Center center;
+                if (method == 0) {
+                    center.location = features[i].centroid();
+                    doubles.clear();
+                    for (auto &point : features[i].contour())
+                        doubles.push_back(norm(center.location - cv::Point2d(point)));
+                    std::sort(doubles.begin(), doubles.end());
+                    center.radius = (doubles[(doubles.size() - 1) / 2] + doubles[doubles.size() / 2]) / 2.;
+                } else if (method == 1)
+                    locateObject(features[i], center, doubles);
+                else
+                    locateObject(features[i], center, floats);
+                radii[i] = center.radius;
+            }
+        };
+        locate();
+        double time = milliseconds([&]() {
+            for (size_t frame = 0; frame < frames; frame++)
+                locate();
+        });
+        if (method == 0)
+            reference = radii;
+        double difference = 0;
+        for (size_t i = 0; i < radii.size(); i++)
+            difference = std::max(difference, std::abs(radii[i] - reference[i]));
+        const char *names[] = {"sort", "select", "float"};
+        std::cout << std::setw(10) << names[method] << std::fixed << std::setprecision(3) << std::setw(12)
+                  << time / frames << std::scientific << std::setprecision(1) << std::setw(16) << difference
+                  << std::endl;
+    }
+}
+
+/* ---------------------------------------------------------------------------------------------- */
+/* benchmarkResult() - compares detect() returning keypoints with detect() filling a detection    */
+/* result, without attributes, with all attributes but the contours and with all attributes, and  */
+/* checks that the objects are the same as the keypoints. Returns false when they are not.        */
+/* ---------------------------------------------------------------------------------------------- */
+bool benchmarkResult(size_t frames) {
+    auto image = generateBlobField(BlobField());
+    ObjectDetector od;
+    od.setThresholdAlgorithm(std::make_shared<ThresholdRangeAlgorithm>(40, 220, 10, 2));
+    od.addFilter(std::make_shared<AreaFilter>(20, 5000));
+    od.addFilter(std::make_shared<CircularityFilter>(0.7, 1.2));
+    auto reference = od.detect(image);
+
+    std::cout << "Keypoints versus a detection result with attributes, " << frames << " frames" << std::endl;
+    std::cout << std::setw(12) << "" << std::setw(12) << "ms/frame" << std::setw(12) << "objects"
+              << std::setw(16) << "contour points" << std::endl;
+    double time = milliseconds([&]() {
+        for (size_t frame = 0; frame < frames; frame++)
+            od.detect(image);
+    });
+    std::cout << std::setw(12) << "keypoints" << std::fixed << std::setprecision(2) << std::setw(12)
+              << time / frames << std::setw(12) << reference.size() << std::setw(16) << 0 << std::endl;
+
+    const char *names[] = {"none", "no contours", "all"};
+    int attributes[] = {0, ATTRIBUTE_ALL & ~ATTRIBUTE_CONTOUR, ATTRIBUTE_ALL};
+    bool passed = true;
+    for (int i = 0; i < 3; i++) {
+        DetectionResult result(attributes[i]);
+        od.detect(image, result);
+        bool equal = result.count() == reference.size();
+        for (size_t k = 0; equal && k < result.count(); k++)
+            equal = result.keypoint(k).pt == reference[k].pt && result.size[k] == reference[k].size;
+        time = milliseconds([&]() {
+            for (size_t frame = 0; frame < frames; frame++)
+                od.detect(image, result);
+        });
+        std::cout << std::setw(12) << names[i] << std::fixed << std::setprecision(2) << std::setw(12)
+                  << time / frames << std::setw(12) << result.count() << std::setw(16) << result.contourPoints.size()
+                  << (equal ? "" : "  NOT THE SAME AS THE KEYPOINTS") << std::endl;
+        passed = equal && passed;
+    }
+    return passed;
+}
+
+/* ---------------------------------------------------------------------------------------------- */
+/* benchmarkMapped() - compares reading frames with cv::imread() from PNG and PGM files with      */
+/* memory-mapping them from a raw Y8 file and a multi-frame PGM file, for reading alone and for   */
+/* reading plus detect(). The files are written to the working directory and removed afterwards.  */
+/* ---------------------------------------------------------------------------------------------- */
+void benchmarkMapped(size_t frames) {
+    ObjectDetector od;
+    od.setThresholdAlgorithm(std::make_shared<ThresholdRangeAlgorithm>(40, 220, 10, 2));
+    od.addFilter(std::make_shared<AreaFilter>(20, 5000));
+
+    std::vector<std::string> pngFiles, pgmFiles;
+    std::ofstream raw("benchmark_frames.y8", std::ios::binary), pgm("benchmark_frames.pgm", std::ios::binary);
+    for (size_t i = 0; i < frames; i++) {
+        BlobField field;
+        field.seed = 42 + (unsigned int)i;
+        auto image = generateBlobField(field);
+        pngFiles.push_back("benchmark_frame_" + std::to_string(i) + ".png");
+        pgmFiles.push_back("benchmark_frame_" + std::to_string(i) + ".pgm");
+        cv::imwrite(pngFiles.back(), image);
+        cv::imwrite(pgmFiles.back(), image);
+        raw.write((const char *)image.data, (std::streamsize)image.total());
+        pgm << "P5\n" << image.cols << " " << image.rows << "\n255\n";
+        pgm.write((const char *)image.data, (std::streamsize)image.total());
+    }
+    raw.close();
+    pgm.close();
+
+    std::cout << "Reading frames with cv::imread() versus memory-mapped, " << frames << " frames" << std::endl;
+    std::cout << std::setw(12) << "" << std::setw(12) << "read (ms)" << std::setw(14) << "+detect (ms)"
+              << std::setw(12) << "keypoints" << std::endl;
+    MappedFrames mapped;
+    for (int method = 0; method < 4; method++) {
+        double read = 0;
+        size_t keypoints = 0;
+        double total = milliseconds([&]() {
+            if (method == 2)
+                mapped.openRaw("benchmark_frames.y8", cv::Size(BlobField().width, BlobField().height), CV_8UC1);
+            else if (method == 3)
+                mapped.openPnm("benchmark_frames.pgm");
+            for (size_t i = 0; i < frames; i++) {
+                cv::Mat image;
+                read += milliseconds([&]() {
+                    if (method < 2)
+                        image = cv::imread(method == 0 ? pngFiles[i] : pgmFiles[i], cv::IMREAD_GRAYSCALE);
+                    else
+                        image = mapped.frame(i);
+                });
+                keypoints += od.detect(image).size();
+            }
+            mapped.close();
+        });
+        const char *names[] = {"png", "pgm", "mapped y8", "mapped pgm"};
+        std::cout << std::setw(12) << names[method] << std::fixed << std::setprecision(2) << std::setw(12)
+                  << read / frames << std::setw(14) << total / frames << std::setw(12) << keypoints / frames
+                  << std::endl;
+    }
+
+    for (size_t i = 0; i < frames; i++) {
+        std::remove(pngFiles[i].c_str());
+        std::remove(pgmFiles[i].c_str());
+    }
+    std::remove("benchmark_frames.y8");
+    std::remove("benchmark_frames.pgm");
+}
+
+/* ---------------------------------------------------------------------------------------------- */
+/* main()                                                                                         */
+/* ---------------------------------------------------------------------------------------------- */
+int main(int argc, char **argv) {
+    std::string which = argc > 1 ? argv[1] : "";
+    if (argc > 4 || (argc > 3 && which != "detection" && which != "pyramid") ||
+        (argc > 1 && which != "grouping" && which != "memory" && which != "detection" && which != "pyramid" &&
+         which != "stream" && which != "static" && which != "batch" && which != "color" &&
+         which != "runlength" && which != "radius" && which != "result" &&
+         which != "mapped")) {
+        std::cout << "Usage: ObjectDetectorBenchmark [grouping | memory [frames] | detection [frames [results.jsonl]] "
+                     "| pyramid [frames [image]] | stream [frames] | static [frames] | batch [frames] | color [frames] "
+                     "| runlength [frames] | radius [frames] | result [frames] | mapped [frames]]" << std::endl;
+        exit(EXIT_FAILURE);
+    }
+
+    bool passed = true;
+    if (which.empty() || which == "grouping")
+        passed = benchmarkGrouping() && passed;
+    if (which.empty() || which == "memory")
+        benchmarkMemory(argc > 2 ? std::stoul(argv[2]) : 1000);
+    if (which.empty() || which == "detection")
+        benchmarkDetection(argc > 2 ? std::stoul(argv[2]) : 5, argc > 3 ? argv[3] : "");
+    if (which.empty() || which == "pyramid")
+        benchmarkPyramid(argc > 2 ? std::stoul(argv[2]) : 10, argc > 3 ? argv[3] : "objects.png");
+    if (which.empty() || which == "stream")
+        benchmarkStream(argc > 2 ? std::stoul(argv[2]) : 300);
+    if (which.empty() || which == "static")
+        passed = benchmarkStatic(argc > 2 ? std::stoul(argv[2]) : 20) && passed;
+    if (which.empty() || which == "batch")
+        passed = benchmarkBatch(argc > 2 ? std::stoul(argv[2]) : 10) && passed;
+    if (which.empty() || which == "color")
+        passed = benchmarkColor(argc > 2 ? std::stoul(argv[2]) : 10) && passed;
+    if (which.empty() || which == "runlength")
+        passed = benchmarkRunLength(argc > 2 ? std::stoul(argv[2]) : 10) && passed;
+    if (which.empty() || which == "radius")
+        benchmarkRadius(argc > 2 ? std::stoul(argv[2]) : 20);
+    if (which.empty() || which == "result")
+        passed = benchmarkResult(argc > 2 ? std::stoul(argv[2]) : 10) && passed;
+    if (which.empty() || which == "mapped")
+        benchmarkMapped(argc > 2 ? std::stoul(argv[2]) : 20);
+    return passed ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,1106 @@
+/* ============================================================================================== */
+/* tests.cpp                                                                                      */
+/*                                                                                                */
+/* This file contains the tests for ObjectDetector. Each test checks that an optimization gives   */
+/* the same results as the code it replaces, or as a plain reference. Run a single test by name,  */
+/* or all of them without arguments; the process fails when a test fails. CMake registers every   */
+/* test with ctest.                                                                               */
+/*                                                                                                */
+/* Joost van Stuijvenberg                                                                         */
+/* ============================================================================================== */
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <random>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "opencv2/opencv.hpp"
+
+#include "CenterGrouping.hpp"
+#include "ContourFeatures.hpp"
+#include "DetectionPipeline.hpp"
+#include "MappedFrames.hpp"
+#include "ObjectDetector.hpp"
+#include "RunLengthLabeler.hpp"
+#include "StaticObjectDetector.hpp"
+#include "StreamDetector.hpp"
+#include "Synthetic.hpp"
+
+/* ---------------------------------------------------------------------------------------------- */
+/* Counts all allocations made with new, by replacing the global operators.                       */
+/* ---------------------------------------------------------------------------------------------- */
+static std::atomic<size_t> allocations(0);
+
+void *operator new(std::size_t size) {
+    allocations++;
+    if (void *p = std::malloc(size == 0 ? 1 : size))
+        return p;
+    throw std::bad_alloc();
+}
+
+void operator delete(void *p) noexcept { std::free(p); }
+void operator delete(void *p, std::size_t) noexcept { std::free(p); }
+
+/* ---------------------------------------------------------------------------------------------- */
+/* expect() - reports a failed check. Returns the condition, so that checks can be chained.       */
+/* ---------------------------------------------------------------------------------------------- */
+bool expect(bool condition, const std::string &message) {
+    if (!condition)
+        std::cout << "  failed: " << message << std::endl;
+    return condition;
+}
+
+/* ---------------------------------------------------------------------------------------------- */
+/* sameKeypoints() - whether both have the same keypoints, in the same order, exactly.            */
+/* ---------------------------------------------------------------------------------------------- */
+bool sameKeypoints(const std::vector<cv::KeyPoint> &a, const std::vector<cv::KeyPoint> &b) {
+    if (a.size() != b.size())
+        return false;
+    for (size_t i = 0; i < a.size(); i++)
+        if (a[i].pt != b[i].pt || a[i].size != b[i].size)
+            return false;
+    return true;
+}
+
+/* ---------------------------------------------------------------------------------------------- */
+/* A small scene that still has overlapping blobs, elongated blobs and noise.                     */
+/* ---------------------------------------------------------------------------------------------- */
+BlobField smallField() {
+    BlobField field;
+    field.width = 640;
+    field.height = 480;
+    field.blobs = 150;
+    return field;
+}
+
+/* ---------------------------------------------------------------------------------------------- */
+/* A scene that is mostly background, for coarse-to-fine detection.                               */
+/* ---------------------------------------------------------------------------------------------- */
+BlobField sparseField() {
+    BlobField field;
+    field.width = 1280;
+    field.height = 960;
+    field.blobs = 20;
+    field.noise = 0;
+    return field;
+}
+
+/* ---------------------------------------------------------------------------------------------- */
+std::shared_ptr<ObjectDetector> rangeDetector() {
+    auto od = std::make_shared<ObjectDetector>();
+    od->setThresholdAlgorithm(std::make_shared<ThresholdRangeAlgorithm>(40, 220, 10, 2));
+    od->addFilter(std::make_shared<AreaFilter>(20, 5000));
+    od->addFilter(std::make_shared<CircularityFilter>(0.7, 1.2));
+    return od;
+}
+
+/* ---------------------------------------------------------------------------------------------- */
+/* testBlobField() - the same parameters yield the same image, another seed another one, and the  */
+/* detector finds objects in it.                                                                  */
+/* ---------------------------------------------------------------------------------------------- */
+bool testBlobField() {
+    auto field = smallField();
+    auto image = generateBlobField(field);
+    bool passed = expect(image.cols == field.width && image.rows == field.height && image.type() == CV_8UC1,
+                         "size and type of the image");
+    passed = expect(cv::norm(image, generateBlobField(field), cv::NORM_INF) == 0, "same image for the same seed")
+             && passed;
+    field.seed++;
+    passed = expect(cv::norm(image, generateBlobField(field), cv::NORM_INF) != 0, "other image for another seed")
+             && passed;
+    return expect(!rangeDetector()->detect(image).empty(), "objects found") && passed;
+}
+
+/* ---------------------------------------------------------------------------------------------- */
+/* testWorkers() - processing the levels on several workers yields the same keypoints as on one,  */
+/* also when the threads of the pool are used again for later frames.                             */
+/* ---------------------------------------------------------------------------------------------- */
+bool testWorkers() {
+    auto serial = rangeDetector(), parallel = rangeDetector();
+    parallel->workers(4);
+    bool passed = true;
+    for (unsigned int seed = 42; seed < 46; seed++) {
+        auto field = smallField();
+        field.seed = seed;
+        auto image = generateBlobField(field);
+        passed = expect(sameKeypoints(serial->detect(image), parallel->detect(image)),
+                        "same keypoints for seed " + std::to_string(seed)) && passed;
+    }
+    return passed;
+}
+
+/* ---------------------------------------------------------------------------------------------- */
+/* testComponentTree() - the regions the component tree reports for each level have the areas and */
+/* centroids of the 8-connected components of the binary image of that level, also when the same  */
+/* context is used for another image first.                                                       */
+/* ---------------------------------------------------------------------------------------------- */
+bool testComponentTree() {
+    ThresholdComponentTreeAlgorithm algorithm(40, 220, 10, 2);
+    auto context = algorithm.createContext();
+    std::vector<std::vector<Region>> levels;
+    std::vector<cv::Mat> binaryImages;
+    cv::Mat labels, stats, centroids;
+    bool passed = true;
+    for (unsigned int seed : {42, 43, 42}) {
+        auto field = smallField();
+        field.seed = seed;
+        auto image = generateBlobField(field);
+        algorithm.regions(image, levels, context.get());
+        algorithm.binaryImages(image, binaryImages);
+        passed = expect(levels.size() == binaryImages.size(), "number of levels") && passed;
+        for (size_t l = 0; l < levels.size() && l < binaryImages.size(); l++) {
+            // Compare area and centroid, sorted, since the order of the regions differs.
+            std::vector<std::array<double, 3>> expected, actual;
+            int count = cv::connectedComponentsWithStats(binaryImages[l], labels, stats, centroids, 8, CV_32S);
+            for (int c = 1; c < count; c++)
+                expected.push_back({(double)stats.at<int>(c, cv::CC_STAT_AREA), centroids.at<double>(c, 0),
+                                    centroids.at<double>(c, 1)});
+            for (auto &region : levels[l])
+                actual.push_back({region.moments.m00, region.moments.m10 / region.moments.m00,
+                                  region.moments.m01 / region.moments.m00});
+            std::sort(expected.begin(), expected.end());
+            std::sort(actual.begin(), actual.end());
+            bool equal = expected.size() == actual.size();
+            for (size_t i = 0; equal && i < expected.size(); i++)
+                equal = expected[i][0] == actual[i][0] && std::abs(expected[i][1] - actual[i][1]) < 1e-6 &&
+                        std::abs(expected[i][2] - actual[i][2]) < 1e-6;
+            passed = expect(equal, "regions of level " + std::to_string(l) + " for seed " + std::to_string(seed))
+                     && passed;
+        }
+    }
+    return passed;
+}
+
+/* ---------------------------------------------------------------------------------------------- */
+/* testGrouping() - grouping the centers in a grid gives the same groups, in the same order, as   */
+/* comparing every center with every group, also for centers at negative coordinates.             */
+/* ---------------------------------------------------------------------------------------------- */
+bool testGrouping() {
+    std::mt19937 rng(42);
+    bool passed = true;
+    for (size_t blobs : {10, 100, 1000}) {
+        auto input = blobLevels(blobs, 12, rng);
+        for (double offset : {0.0, -500.0}) {
+            for (auto &level : input)
+                for (auto &center : level)
+                    center.location += cv::Point2d(offset, offset);
+            CenterGrouping grouping(10.0);
+            for (auto &level : input)
+                grouping.addLevel(level);
+            passed = expect(sameGroups(groupNaive(input, 10.0), grouping.groups()),
+                            "same groups for " + std::to_string(blobs) + " blobs, offset " + std::to_string(offset))
+                     && passed;
+        }
+    }
+    return passed;
+}
+
+/* ---------------------------------------------------------------------------------------------- */
+/* testImageBuffers() - once the first frame has been processed, detect() does not allocate image */
+/* data anymore, also when the frames alternate between different scenes.                         */
+/* ---------------------------------------------------------------------------------------------- */
+bool testImageBuffers() {
+    cv::Mat images[2];
+    for (unsigned int i = 0; i < 2; i++) {
+        auto field = smallField();
+        field.seed = 42 + i;
+        images[i] = generateBlobField(field);
+    }
+    std::vector<std::pair<std::string, std::shared_ptr<ThresholdAlgorithm>>> algorithms = {
+            {"fixed", std::make_shared<ThresholdFixedAlgorithm>(128)},
+            {"range", std::make_shared<ThresholdRangeAlgorithm>(40, 220, 10, 2)},
+            {"otsu", std::make_shared<ThresholdOtsuAlgorithm>()}};
+    bool passed = true;
+    for (auto &algorithm : algorithms) {
+        auto od = rangeDetector();
+        od->setThresholdAlgorithm(algorithm.second);
+        od->instrumentation(true);
+        od->detect(images[0]);
+        size_t imageAllocations = 0;
+        for (int frame = 1; frame <= 4; frame++) {
+            od->detect(images[frame % 2]);
+            imageAllocations += od->trace().imageAllocations;
+        }
+        passed = expect(imageAllocations == 0, "no image allocations for " + algorithm.first) && passed;
+    }
+    return passed;
+}
+
+/* ---------------------------------------------------------------------------------------------- */
+/* testContexts() - threads that share a detector, each with a context of its own, find the same  */
+/* keypoints as the detector on its own.                                                          */
+/* ---------------------------------------------------------------------------------------------- */
+bool testContexts() {
+    std::vector<cv::Mat> images;
+    for (unsigned int seed = 42; seed < 46; seed++) {
+        auto field = smallField();
+        field.seed = seed;
+        images.push_back(generateBlobField(field));
+    }
+    auto od = rangeDetector();
+    std::vector<std::vector<cv::KeyPoint>> expected;
+    for (auto &image : images)
+        expected.push_back(od->detect(image));
+
+    // Every thread processes all images, each starting at another one.
+    std::vector<std::vector<std::vector<cv::KeyPoint>>> actual(images.size());
+    std::vector<std::thread> threads;
+    const ObjectDetector &shared = *od;
+    for (size_t t = 0; t < images.size(); t++)
+        threads.emplace_back([&, t]() {
+            DetectionContext context;
+            actual[t].resize(images.size());
+            for (size_t i = 0; i < images.size(); i++) {
+                size_t image = (t + i) % images.size();
+                actual[t][image] = shared.detect(images[image], context);
+            }
+        });
+    for (auto &thread : threads)
+        thread.join();
+
+    bool passed = true;
+    for (size_t t = 0; t < images.size(); t++)
+        for (size_t i = 0; i < images.size(); i++)
+            passed = expect(sameKeypoints(expected[i], actual[t][i]),
+                            "same keypoints for image " + std::to_string(i) + " on thread " + std::to_string(t))
+                     && passed;
+    return passed;
+}
+
+/* ---------------------------------------------------------------------------------------------- */
+/* testContourFeatures() - features are the same as when computed directly, and each one is only  */
+/* computed once per contour, or once per binary image for the bounding rectangle of the image.   */
+/* ---------------------------------------------------------------------------------------------- */
+bool testContourFeatures() {
+    cv::Mat gray(200, 200, CV_8UC1, cv::Scalar(30)), binaryImage;
+    cv::circle(gray, cv::Point(50, 60), 20, cv::Scalar(200), -1);
+    cv::ellipse(gray, cv::Point(140, 120), cv::Size(40, 15), 30, 0, 360, cv::Scalar(200), -1);
+    threshold(gray, binaryImage, 100, 255, cv::THRESH_BINARY);
+    std::vector<std::vector<cv::Point>> contours;
+    findContours(binaryImage, contours, cv::RETR_LIST, cv::CHAIN_APPROX_SIMPLE);
+
+    LevelFeatures level;
+    ContourFeatureCounters counters;
+    bool passed = expect(contours.size() == 2, "two contours");
+    for (auto &contour : contours) {
+        auto contourMoments = moments(contour);
+        ContourFeatures features(gray, binaryImage, contour, contourMoments, &level, &counters);
+        for (int repeat = 0; repeat < 2; repeat++) {
+            std::vector<cv::Point> hull;
+            cv::convexHull(contour, hull);
+            passed = expect(features.perimeter() == cv::arcLength(contour, true), "perimeter") && passed;
+            passed = expect(features.hull() == hull, "hull") && passed;
+            passed = expect(features.hullArea() == cv::contourArea(hull), "hull area") && passed;
+            passed = expect(features.boundingRect() == cv::boundingRect(contour), "bounding rectangle") && passed;
+            passed = expect(features.binaryBoundingRect() == cv::boundingRect(binaryImage),
+                            "bounding rectangle of the binary image") && passed;
+        }
+    }
+    for (auto feature : {FEATURE_PERIMETER, FEATURE_HULL_AREA, FEATURE_BOUNDING_RECT})
+        passed = expect(counters.requested[feature] == 2 * contours.size() &&
+                        counters.computed[feature] == contours.size(),
+                        "feature " + std::to_string(feature) + " computed once per contour") && passed;
+    return expect(counters.computed[FEATURE_BINARY_BOUNDING_RECT] == 1,
+                  "bounding rectangle of the binary image computed once") && passed;
+}
+
+/* ---------------------------------------------------------------------------------------------- */
+/* testAdaptiveFilterOrder() - reordering the filters does not change the keypoints, and the time */
+/* of every filter is measured, also of the filters that run in batches. Filters that replace the */
+/* others start without statistics, also when they are at the same addresses.                     */
+/* ---------------------------------------------------------------------------------------------- */
+bool testAdaptiveFilterOrder() {
+    bool passed = true;
+    for (bool batch : {false, true}) {
+        auto reference = rangeDetector(), od = rangeDetector();
+        reference->addFilter(std::make_shared<InertiaFilter>(0.5, 1.1));
+        od->addFilter(std::make_shared<InertiaFilter>(0.5, 1.1));
+        od->adaptiveFilterOrder(true);
+        od->filterReorderInterval(100);
+        od->batchFilters(batch);
+        std::string mode = batch ? " in batches" : "";
+        for (unsigned int seed = 42; seed < 46; seed++) {
+            auto field = smallField();
+            field.seed = seed;
+            auto image = generateBlobField(field);
+            passed = expect(sameKeypoints(reference->detect(image), od->detect(image)),
+                            "same keypoints for seed " + std::to_string(seed) + mode) && passed;
+        }
+        for (auto &statistics : od->filterStatistics())
+            passed = expect(statistics.evaluations > 0 && statistics.seconds > 0, "filters timed" + mode) && passed;
+    }
+
+    auto image = generateBlobField(smallField());
+    std::vector<std::shared_ptr<Filter>> filters = {std::make_shared<AreaFilter>(20, 5000),
+                                                    std::make_shared<CircularityFilter>(0.7, 1.2)};
+    ObjectDetector od, fresh;
+    for (auto detector : {&od, &fresh}) {
+        detector->setThresholdAlgorithm(std::make_shared<ThresholdRangeAlgorithm>(40, 220, 10, 2));
+        detector->adaptiveFilterOrder(true);
+        for (auto &filter : filters)
+            detector->addFilter(filter);
+    }
+    od.detect(image);
+    od.clearFilters();
+    for (auto &filter : filters)
+        od.addFilter(filter);
+    od.detect(image);
+    fresh.detect(image);
+    bool same = od.filterStatistics().size() == fresh.filterStatistics().size();
+    for (size_t f = 0; same && f < filters.size(); f++)
+        same = od.filterStatistics()[f].evaluations == fresh.filterStatistics()[f].evaluations;
+    return expect(same, "statistics start over when the filters are replaced") && passed;
+}
+
+/* ---------------------------------------------------------------------------------------------- */
+/* testTrace() - the trace holds the stages of a single call to detect(): in coarse-to-fine mode, */
+/* those of every region of interest, and nothing of the calls before. Written out, the times of  */
+/* late events keep their microseconds.                                                           */
+/* ---------------------------------------------------------------------------------------------- */
+bool testTrace() {
+    auto image = generateBlobField(sparseField());
+    auto od = rangeDetector();
+    od->instrumentation(true);
+    od->pyramidLevels(2);
+    bool passed = true;
+    size_t events = 0;
+    for (int call = 0; call < 3; call++) {
+        od->detect(image);
+        auto &trace = od->trace();
+        size_t groupings = std::count_if(trace.events.begin(), trace.events.end(),
+                                         [](const TraceEvent &e) { return e.stage == STAGE_GROUPING; });
+        passed = expect(od->regionsOfInterest().size() > 1 && groupings == od->regionsOfInterest().size(),
+                        "one grouping per region of interest") && passed;
+        passed = expect(call == 0 || trace.events.size() == events, "same events for every call") && passed;
+        events = trace.events.size();
+    }
+
+    // An event long after the start keeps its microseconds, and the stream its formatting.
+    DetectionTrace trace;
+    trace.add(STAGE_GROUPING, -1, 0, 1.234567891, 1.2345688);
+    std::ostringstream json;
+    json << 0.5;
+    trace.writeChromeTrace(json);
+    json << 0.123456789;
+    auto text = json.str();
+    passed = expect(text.find("\"ts\":1234567.891,\"dur\":0.909") != std::string::npos, "times in microseconds")
+             && passed;
+    return expect(text.compare(0, 3, "0.5") == 0 && text.substr(text.size() - 8) == "0.123457", "formatting restored")
+           && passed;
+}
+
+/* ---------------------------------------------------------------------------------------------- */
+/* testParameters() - a detector read from parameters, as the batch tool does, finds the same     */
+/* keypoints as a detector with the same configuration in code, and keeps the default settings    */
+/* that the parameters leave out. The settings it writes are read back unchanged.                 */
+/* ---------------------------------------------------------------------------------------------- */
+bool testParameters() {
+    const std::string parameters =
+            "<?xml version=\"1.0\"?>\n"
+            "<opencv_storage>\n"
+            "<thresholdAlgorithm>\n"
+            "  <ThresholdRangeAlgorithm>\n"
+            "    <min>40</min><max>220</max><step>10</step><minRepeatability>2</minRepeatability>\n"
+            "  </ThresholdRangeAlgorithm>\n"
+            "</thresholdAlgorithm>\n"
+            "<minDistBetweenObjects>10.</minDistBetweenObjects>\n"
+            "<filters>\n"
+            "  <AreaFilter><min>20.</min><max>5000.</max></AreaFilter>\n"
+            "  <CircularityFilter><min>0.7</min><max>1.2</max></CircularityFilter>\n"
+            "</filters>\n"
+            "</opencv_storage>\n";
+    cv::FileStorage storage(parameters, cv::FileStorage::READ | cv::FileStorage::MEMORY);
+    if (!expect(storage.isOpened(), "parameters parsed"))
+        return false;
+    ObjectDetector od, defaults;
+    od.read(storage.root());
+    auto image = generateBlobField(smallField());
+    bool passed = expect(sameKeypoints(rangeDetector()->detect(image), od.detect(image)), "same keypoints");
+    passed = expect(od.workers() == defaults.workers() && od.tileSize() == defaults.tileSize() &&
+                    od.filterReorderInterval() == defaults.filterReorderInterval(), "default settings kept") && passed;
+
+    od.workers(3);
+    od.adaptiveFilterOrder(true);
+    od.filterReorderInterval(50);
+    od.batchFilters(true);
+    od.floatRadius(true);
+    od.runLengthLevels(true);
+    od.connectedComponents(true);
+    od.instrumentation(true);
+    od.pyramidLevels(2);
+    od.tileSize(512);
+    od.tileHalo(30);
+    cv::FileStorage out("parameters.xml", cv::FileStorage::WRITE | cv::FileStorage::MEMORY);
+    od.write(out);
+    cv::FileStorage in(out.releaseAndGetString(), cv::FileStorage::READ | cv::FileStorage::MEMORY);
+    ObjectDetector read;
+    read.read(in.root());
+    return expect(read.workers() == 3 && read.adaptiveFilterOrder() && read.filterReorderInterval() == 50 &&
+                  read.batchFilters() && read.floatRadius() && read.runLengthLevels() && read.connectedComponents() &&
+                  read.instrumentation() && read.pyramidLevels() == 2 && read.tileSize() == 512 &&
+                  read.tileHalo() == 30, "settings read back") && passed;
+}
+
+/* ---------------------------------------------------------------------------------------------- */
+/* testTiles() - detecting tile by tile finds the same keypoints as detecting in the whole image, */
+/* apart from the order and from rounding, with one worker and with several.                      */
+/* ---------------------------------------------------------------------------------------------- */
+bool testTiles() {
+    auto image = generateBlobField(smallField());
+    auto od = rangeDetector();
+    auto expected = od->detect(image);
+    od->tileSize(160);
+    bool passed = true;
+    for (unsigned int workers : {1, 4}) {
+        od->workers(workers);
+        passed = expect(sameKeypointSets(expected, od->detectTiled(image), 1e-3),
+                        "same keypoints with " + std::to_string(workers) + " workers") && passed;
+    }
+    return passed;
+}
+
+/* ---------------------------------------------------------------------------------------------- */
+/* testPyramid() - every keypoint of coarse-to-fine detection is also found at full resolution,   */
+/* so no object that is cut off by the edge of a region of interest is reported. The same holds   */
+/* for a detection result.                                                                        */
+/* ---------------------------------------------------------------------------------------------- */
+bool testPyramid() {
+    auto image = generateBlobField(sparseField());
+    auto od = rangeDetector();
+    auto expected = od->detect(image);
+    od->pyramidLevels(2);
+    auto keypoints = od->detect(image);
+    DetectionResult result;
+    od->detect(image, result);
+    std::vector<cv::KeyPoint> objects;
+    for (size_t i = 0; i < result.count(); i++)
+        objects.push_back(result.keypoint(i));
+
+    bool passed = expect(od->regionsOfInterest().size() > 1, "regions of interest");
+    for (auto *found : {&keypoints, &objects}) {
+        bool matched = !found->empty();
+        for (auto &k : *found)
+            matched = matched && std::any_of(expected.begin(), expected.end(), [&](const cv::KeyPoint &e) {
+                return cv::norm(e.pt - k.pt) <= 1e-3 && std::abs(e.size - k.size) <= 1e-3;
+            });
+        passed = expect(matched, found == &keypoints ? "keypoints found at full resolution"
+                                                      : "objects found at full resolution") && passed;
+    }
+    return passed;
+}
+
+/* ---------------------------------------------------------------------------------------------- */
+/* testStream() - for blobs that move across the frames, each on a row of its own, the stream     */
+/* detector finds the keypoints of detect() on the frames it processes as a whole, and a subset   */
+/* of them on the other frames. An object keeps its track id from frame to frame.                 */
+/* ---------------------------------------------------------------------------------------------- */
+bool testStream() {
+    auto od = std::make_shared<ObjectDetector>();
+    od->setThresholdAlgorithm(std::make_shared<ThresholdRangeAlgorithm>(40, 150, 10, 3));
+    od->addFilter(std::make_shared<AreaFilter>(50, 5000));
+    StreamDetector sd(od);
+    sd.rescanInterval(10);
+
+    std::mt19937 rng(42);
+    std::uniform_real_distribution<double> x(0, 640), speed(2, 6), radius(8, 16);
+    struct Blob { double x, speed, radius; };
+    std::vector<Blob> blobs;
+    for (int i = 0; i < 10; i++)
+        blobs.push_back(Blob{x(rng), speed(rng), radius(rng)});
+
+    bool passed = true;
+    std::vector<cv::KeyPoint> previous;
+    for (int frame = 0; frame < 30; frame++) {
+        cv::Mat image(480, 640, CV_8UC1, cv::Scalar(30));
+        for (size_t i = 0; i < blobs.size(); i++) {
+            auto &blob = blobs[i];
+            double bx = std::fmod(blob.x + blob.speed * frame, 640.0 + 4 * blob.radius) - 2 * blob.radius;
+            cv::circle(image, cv::Point((int)bx, 40 + 40 * (int)i), (int)blob.radius, cv::Scalar(200), -1);
+        }
+        auto expected = od->detect(image);
+        auto keypoints = sd.process(image);
+        std::string which = " in frame " + std::to_string(frame);
+        if (frame % 10 == 0)
+            passed = expect(sameKeypoints(expected, keypoints), "same keypoints" + which) && passed;
+        for (auto &k : keypoints) {
+            passed = expect(std::any_of(expected.begin(), expected.end(), [&](const cv::KeyPoint &e) {
+                return cv::norm(e.pt - k.pt) <= 1e-3 && std::abs(e.size - k.size) <= 1e-3;
+            }), "keypoint found by detect()" + which) && passed;
+            for (auto &p : previous)
+                if (std::abs(p.pt.y - k.pt.y) < 10 && std::abs(p.pt.x - k.pt.x) < 10)
+                    passed = expect(p.class_id == k.class_id, "same track id" + which) && passed;
+        }
+        previous = keypoints;
+    }
+    return passed;
+}
+
+/* ---------------------------------------------------------------------------------------------- */
+/* testStaticDetector() - a detector with a compile-time filter chain finds the same keypoints as */
+/* an ObjectDetector with the same threshold algorithm and filters, for several scenes.           */
+/* ---------------------------------------------------------------------------------------------- */
+bool testStaticDetector() {
+    ThresholdRangeAlgorithm algorithm(40, 220, 10, 2);
+    AreaFilter area(20, 5000);
+    CircularityFilter circularity(0.7, 1.2);
+    InertiaFilter inertia(0.5, 1.1);
+    ObjectDetector od;
+    od.setThresholdAlgorithm(std::make_shared<ThresholdRangeAlgorithm>(algorithm));
+    od.addFilter(std::make_shared<AreaFilter>(area));
+    od.addFilter(std::make_shared<CircularityFilter>(circularity));
+    od.addFilter(std::make_shared<InertiaFilter>(inertia));
+    StaticObjectDetector<ThresholdRangeAlgorithm, AreaFilter, CircularityFilter, InertiaFilter>
+            sod(algorithm, area, circularity, inertia);
+
+    bool passed = true;
+    for (unsigned int seed = 42; seed < 45; seed++) {
+        auto field = smallField();
+        field.seed = seed;
+        auto image = generateBlobField(field);
+        passed = expect(sameKeypoints(od.detect(image), sod.detect(image)),
+                        "same keypoints for seed " + std::to_string(seed)) && passed;
+    }
+    return passed;
+}
+
+/* ---------------------------------------------------------------------------------------------- */
+/* testBatchFilters() - filtering the contours in batches finds the same keypoints as filtering   */
+/* one contour at a time, also with a filter that has no batch support, and computes the same     */
+/* features.                                                                                      */
+/* ---------------------------------------------------------------------------------------------- */
+bool testBatchFilters() {
+    BlobField field = smallField();
+    field.minRadius = 2;
+    field.maxRadius = 8;
+    field.blobs = 1000;
+    auto image = generateBlobField(field);
+    std::vector<cv::KeyPoint> keypoints[2];
+    ContourFeatureCounters counters[2];
+    for (int batch = 0; batch < 2; batch++) {
+        auto od = rangeDetector();
+        od->addFilter(std::make_shared<InertiaFilter>(0.4, 1.1));
+        od->addFilter(std::make_shared<ConvexityFilter>(0.8, 1.1));
+        od->batchFilters(batch == 1);
+        keypoints[batch] = od->detect(image);
+        counters[batch] = od->featureCounters();
+    }
+    bool passed = expect(sameKeypoints(keypoints[0], keypoints[1]), "same keypoints");
+    for (auto feature : {FEATURE_PERIMETER, FEATURE_INERTIA_RATIO, FEATURE_HULL_AREA})
+        passed = expect(counters[0].computed[feature] == counters[1].computed[feature],
+                        "feature " + std::to_string(feature) + " computed as often") && passed;
+    return passed;
+}
+
+/* ---------------------------------------------------------------------------------------------- */
+/* testConnectedComponents() - labeling connected components is off unless asked for, so that an  */
+/* area filter alone still finds the keypoints of the static detector. When switched on, it finds */
+/* the same objects in a scene of disks, at nearly the same locations.                            */
+/* ---------------------------------------------------------------------------------------------- */
+bool testConnectedComponents() {
+    BlobField field = smallField();
+    field.blobs = 60;
+    field.elongated = 0;
+    field.noise = 0;
+    auto image = generateBlobField(field);
+    ThresholdRangeAlgorithm algorithm(40, 220, 10, 2);
+    AreaFilter area(20, 5000);
+    ObjectDetector od;
+    od.setThresholdAlgorithm(std::make_shared<ThresholdRangeAlgorithm>(algorithm));
+    od.addFilter(std::make_shared<AreaFilter>(area));
+    StaticObjectDetector<ThresholdRangeAlgorithm, AreaFilter> sod(algorithm, area);
+    auto expected = od.detect(image);
+    bool passed = expect(!od.connectedComponents(), "off by default");
+    passed = expect(sameKeypoints(expected, sod.detect(image)), "same keypoints as the static detector") && passed;
+
+    od.connectedComponents(true);
+    auto keypoints = od.detect(image);
+    bool near = expected.size() == keypoints.size();
+    for (auto &k : keypoints)
+        near = near && std::any_of(expected.begin(), expected.end(), [&](const cv::KeyPoint &e) {
+            return cv::norm(e.pt - k.pt) <= 1.0;
+        });
+    return expect(near, "same objects with connected components") && passed;
+}
+
+/* ---------------------------------------------------------------------------------------------- */
+/* The range algorithm without leaving out any levels, as a reference.                            */
+/* ---------------------------------------------------------------------------------------------- */
+class AllLevelsAlgorithm : public ThresholdRangeAlgorithm {
+public:
+    using ThresholdRangeAlgorithm::ThresholdRangeAlgorithm;
+    using ThresholdRangeAlgorithm::binaryImages;
+    inline void binaryImages(const cv::Mat &image, std::vector<cv::Mat> &binaryImages,
+                             std::vector<int> &levelCounts) const override {
+        ThresholdRangeAlgorithm::binaryImages(image, binaryImages);
+        levelCounts.assign(binaryImages.size(), 1);
+    }
+};
+
+/* ---------------------------------------------------------------------------------------------- */
+/* testLevelCounts() - leaving out the levels that yield the same binary image as the level       */
+/* before them gives the same keypoints as processing every level, for a scene with few distinct  */
+/* gray values as well as a noisy one.                                                            */
+/* ---------------------------------------------------------------------------------------------- */
+bool testLevelCounts() {
+    bool passed = true;
+    for (double noise : {0.0, 8.0}) {
+        BlobField field = smallField();
+        field.noise = noise;
+        auto image = generateBlobField(field);
+        ThresholdRangeAlgorithm algorithm(40, 220, 10, 2);
+        std::vector<cv::Mat> binaryImages;
+        std::vector<int> levelCounts;
+        algorithm.binaryImages(image, binaryImages, levelCounts);
+        int levels = 0;
+        for (int count : levelCounts)
+            levels += count;
+        std::string which = " for noise " + std::to_string(noise);
+        passed = expect(levels == 19, "levels counted" + which) && passed;
+        passed = expect(noise > 0 || levelCounts.size() < 19, "levels left out" + which) && passed;
+
+        auto od = rangeDetector(), reference = rangeDetector();
+        reference->setThresholdAlgorithm(std::make_shared<AllLevelsAlgorithm>(40, 220, 10, 2));
+        passed = expect(sameKeypoints(reference->detect(image), od->detect(image)), "same keypoints" + which)
+                 && passed;
+    }
+    return passed;
+}
+
+/* ---------------------------------------------------------------------------------------------- */
+/* testAdaptiveThreshold() - the adaptive threshold over the integral image, with the vectorized  */
+/* row kernel, gives the same binary image as summing each block of pixels, for both methods and  */
+/* for blocks larger than the image.                                                              */
+/* ---------------------------------------------------------------------------------------------- */
+bool testAdaptiveThreshold() {
+    BlobField field = smallField();
+    field.width = 123;
+    field.height = 91;
+    field.blobs = 10;
+    auto image = generateBlobField(field);
+    // Uneven illumination.
+    for (int y = 0; y < image.rows; y++)
+        for (int x = 0; x < image.cols; x++)
+            image.at<uchar>(y, x) = cv::saturate_cast<uchar>(image.at<uchar>(y, x) + x / 4);
+
+    bool passed = true;
+    std::vector<cv::Mat> binaryImages;
+    for (auto method : {ThresholdAdaptiveAlgorithm::MEAN, ThresholdAdaptiveAlgorithm::SAUVOLA})
+        for (int blockSize : {1, 15, 151}) {
+            ThresholdAdaptiveAlgorithm algorithm(blockSize, method, 5, 0.3);
+            algorithm.binaryImages(image, binaryImages);
+            int r = blockSize / 2;
+            bool equal = binaryImages.size() == 1;
+            for (int y = 0; equal && y < image.rows; y++)
+                for (int x = 0; equal && x < image.cols; x++) {
+                    double sum = 0, squares = 0, area = 0;
+                    for (int by = std::max(y - r, 0); by <= std::min(y + r, image.rows - 1); by++)
+                        for (int bx = std::max(x - r, 0); bx <= std::min(x + r, image.cols - 1); bx++) {
+                            double p = image.at<uchar>(by, bx);
+                            sum += p;
+                            squares += p * p;
+                            area++;
+                        }
+                    double mean = sum / area, t = mean + 5;
+                    if (method == ThresholdAdaptiveAlgorithm::SAUVOLA) {
+                        double stddev = std::sqrt(std::max(squares / area - mean * mean, 0.0));
+                        t = mean * (1 + 0.3 * (stddev / 128 - 1));
+                    }
+                    equal = binaryImages[0].at<uchar>(y, x) == (image.at<uchar>(y, x) > t ? 255 : 0);
+                }
+            passed = expect(equal, std::string(method == ThresholdAdaptiveAlgorithm::MEAN ? "mean" : "Sauvola") +
+                                   " threshold for block size " + std::to_string(blockSize)) && passed;
+        }
+    return passed;
+}
+
+/* ---------------------------------------------------------------------------------------------- */
+/* testColor() - converting and thresholding a color image in a single pass gives the same        */
+/* keypoints as converting it to grayscale first. After the first frame it allocates no image     */
+/* data, also when the frames leave out different numbers of levels.                              */
+/* ---------------------------------------------------------------------------------------------- */
+bool testColor() {
+    auto image = generateBlobField(smallField());
+    // The second frame has no pixels above 100, so that all levels above it are left out.
+    cv::Mat colorFrames[2], grayFrames[2];
+    grayFrames[0] = image;
+    cv::min(image, 100, grayFrames[1]);
+    for (int i = 0; i < 2; i++)
+        cvtColor(grayFrames[i], colorFrames[i], cv::COLOR_GRAY2BGR);
+
+    auto od = rangeDetector(), reference = rangeDetector();
+    od->instrumentation(true);
+    bool passed = true;
+    for (int frame = 0; frame < 5; frame++) {
+        cv::Mat gray;
+        cvtColor(colorFrames[frame % 2], gray, cv::COLOR_BGR2GRAY);
+        passed = expect(sameKeypoints(reference->detect(gray), od->detect(colorFrames[frame % 2])),
+                        "same keypoints in frame " + std::to_string(frame)) && passed;
+        passed = expect(frame == 0 || od->trace().imageAllocations == 0,
+                        "no image allocations in frame " + std::to_string(frame)) && passed;
+    }
+    return passed;
+}
+
+/* ---------------------------------------------------------------------------------------------- */
+/* testRunLength() - the run-length encoded levels decode into the binary images of the levels,   */
+/* labeling them yields the regions of the component tree for the same levels, and detection on   */
+/* them finds the keypoints of the component tree, apart from the order and from rounding. With   */
+/* connected components, it finds those of the components of 8-bit levels.                        */
+/* ---------------------------------------------------------------------------------------------- */
+bool testRunLength() {
+    auto image = generateBlobField(smallField());
+    ThresholdRangeAlgorithm algorithm(40, 220, 10, 2);
+    std::vector<cv::Mat> binaryImages;
+    std::vector<RunLengthImage> levels;
+    std::vector<int> levelCounts, runLengthCounts;
+    algorithm.binaryImages(image, binaryImages, levelCounts);
+    algorithm.runLengthImages(image, levels, runLengthCounts);
+    bool passed = expect(levelCounts == runLengthCounts, "same level counts");
+    cv::Mat decoded;
+    for (size_t l = 0; l < levelCounts.size() && l < levels.size(); l++) {
+        levels[l].decode(decoded);
+        passed = expect(cv::norm(decoded, binaryImages[l], cv::NORM_INF) == 0,
+                        "same binary image for level " + std::to_string(l)) && passed;
+    }
+
+    // Compare the moments and contours, sorted, since the order of the regions differs.
+    ThresholdComponentTreeAlgorithm tree(40, 220, 10, 2);
+    auto context = tree.createContext();
+    std::vector<std::vector<Region>> treeLevels;
+    std::vector<Region> regions;
+    RunLengthLabeler labeler;
+    RunLengthImage level;
+    tree.regions(image, treeLevels, context.get());
+    auto key = [](const Region &region) {
+        auto &m = region.moments;
+        std::vector<double> key = {m.m00, m.m10, m.m01, m.m20, m.m11, m.m02, m.m30, m.m21, m.m12, m.m03};
+        for (auto &point : region.contour) {
+            key.push_back(point.x);
+            key.push_back(point.y);
+        }
+        return key;
+    };
+    for (size_t l = 0; l < treeLevels.size(); l++) {
+        level.threshold(image, 40 + 10 * (int)l);
+        labeler.regions(level, true, regions);
+        std::vector<std::vector<double>> expected, actual;
+        for (auto &region : treeLevels[l])
+            expected.push_back(key(region));
+        for (auto &region : regions)
+            actual.push_back(key(region));
+        std::sort(expected.begin(), expected.end());
+        std::sort(actual.begin(), actual.end());
+        passed = expect(expected == actual, "regions of level " + std::to_string(l)) && passed;
+    }
+
+    auto od = rangeDetector(), reference = rangeDetector();
+    reference->setThresholdAlgorithm(std::make_shared<ThresholdComponentTreeAlgorithm>(tree));
+    od->runLengthLevels(true);
+    passed = expect(sameKeypointSets(reference->detect(image), od->detect(image), 1e-3),
+                    "same keypoints as the component tree") && passed;
+
+    od = std::make_shared<ObjectDetector>();
+    reference = std::make_shared<ObjectDetector>();
+    for (auto detector : {od, reference}) {
+        detector->setThresholdAlgorithm(std::make_shared<ThresholdRangeAlgorithm>(algorithm));
+        detector->addFilter(std::make_shared<AreaFilter>(20, 5000));
+        detector->connectedComponents(true);
+    }
+    od->runLengthLevels(true);
+    return expect(sameKeypointSets(reference->detect(image), od->detect(image), 1e-3),
+                  "same keypoints as the connected components") && passed;
+}
+
+/* ---------------------------------------------------------------------------------------------- */
+/* testAllocations() - once the buffers have been filled by the first frame, every frame makes    */
+/* the same, smaller number of allocations. OpenCV runs on this thread only meanwhile, so that    */
+/* its own allocations are the same for every frame too.                                          */
+/* ---------------------------------------------------------------------------------------------- */
+bool testAllocations() {
+    auto image = generateBlobField(smallField());
+    int threads = cv::getNumThreads();
+    cv::setNumThreads(0);
+    auto od = rangeDetector();
+    od->addFilter(std::make_shared<InertiaFilter>(0.5, 1.1));
+    std::vector<size_t> perFrame;
+    for (int frame = 0; frame < 5; frame++) {
+        size_t start = allocations;
+        od->detect(image);
+        perFrame.push_back(allocations - start);
+    }
+    cv::setNumThreads(threads);
+
+    bool passed = expect(perFrame[1] < perFrame[0], "fewer allocations after the first frame");
+    for (size_t frame = 2; frame < perFrame.size(); frame++)
+        passed = expect(perFrame[frame] == perFrame[1], "same allocations in frame " + std::to_string(frame))
+                 && passed;
+    return passed;
+}
+
+/* ---------------------------------------------------------------------------------------------- */
+/* testRadius() - selecting the median distance gives exactly the radius of sorting all distances */
+/* to the contour points; in single precision it differs less than 1e-4 pixels.                   */
+/* ---------------------------------------------------------------------------------------------- */
+bool testRadius() {
+    BlobField field = smallField();
+    field.maxRadius = 60;
+    cv::Mat image = generateBlobField(field), binaryImage;
+    threshold(image, binaryImage, 100, 255, cv::THRESH_BINARY);
+    std::vector<std::vector<cv::Point>> contours;
+    findContours(binaryImage, contours, cv::RETR_LIST, cv::CHAIN_APPROX_SIMPLE);
+
+    bool exact = true, close = true;
+    std::vector<double> doubles, sorted;
+    std::vector<float> floats;
+    for (auto &contour : contours) {
+        auto contourMoments = moments(contour, true);
+        if (contourMoments.m00 == 0.0)
+            continue;
+        ContourFeatures features(image, binaryImage, contour, contourMoments);
+        sorted.clear();
+        for (auto &point : contour)
+            sorted.push_back(norm(features.centroid() - cv::Point2d(point)));
+        std::sort(sorted.begin(), sorted.end());
+        double radius = (sorted[(sorted.size() - 1) / 2] + sorted[sorted.size() / 2]) / 2.;
+        Center selected, single;
+        locateObject(features, selected, doubles);
+        locateObject(features, single, floats);
+        exact = exact && selected.radius == radius && selected.location == features.centroid();
+        close = close && std::abs(single.radius - radius) < 1e-4;
+    }
+    bool passed = expect(!contours.empty(), "contours found");
+    passed = expect(exact, "same radius in double precision") && passed;
+    return expect(close, "nearly the same radius in single precision") && passed;
+}
+
+/* ---------------------------------------------------------------------------------------------- */
+/* testDetectionResult() - a detection result holds the keypoints, in the same order, whatever    */
+/* attributes it asks for, and the attributes of every object are filled and within the limits    */
+/* of the filters.                                                                                */
+/* ---------------------------------------------------------------------------------------------- */
+bool testDetectionResult() {
+    auto image = generateBlobField(smallField());
+    auto od = rangeDetector();
+    auto expected = od->detect(image);
+    bool passed = true;
+    for (int attributes : {0, ATTRIBUTE_ALL & ~ATTRIBUTE_CONTOUR, (int)ATTRIBUTE_ALL}) {
+        DetectionResult result(attributes);
+        od->detect(image, result);
+        std::string which = " for attributes " + std::to_string(attributes);
+        std::vector<cv::KeyPoint> keypoints;
+        for (size_t i = 0; i < result.count(); i++)
+            keypoints.push_back(result.keypoint(i));
+        passed = expect(sameKeypoints(expected, keypoints), "same keypoints" + which) && passed;
+        if (attributes == 0)
+            continue;
+
+        size_t n = result.count();
+        bool contours = attributes == ATTRIBUTE_ALL;
+        bool filled = result.area.size() == n && result.bounds.size() == n && result.circularity.size() == n &&
+                      result.inertia.size() == n && result.confidence.size() == n &&
+                      result.repeatability.size() == n &&
+                      (contours ? result.contourStart.size() == n + 1 : result.contourPoints.empty());
+        passed = expect(filled, "attributes filled" + which) && passed;
+        for (size_t i = 0; filled && i < n; i++)
+            filled = result.area[i] >= 20 && result.area[i] <= 5000 && result.circularity[i] >= 0.7f &&
+                     result.circularity[i] <= 1.2f && result.repeatability[i] >= 2;
+        passed = expect(filled, "attributes within the limits of the filters" + which) && passed;
+    }
+    return passed;
+}
+
+/* ---------------------------------------------------------------------------------------------- */
+/* testPipeline() - the detection pipeline passes every image that could be decoded through the   */
+/* sink once, with the keypoints of detect(), even with a queue too small for its workers. An     */
+/* exception in a stage stops the pipeline and is passed on by run().                             */
+/* ---------------------------------------------------------------------------------------------- */
+bool testPipeline() {
+    const size_t count = 12;
+    std::vector<cv::Mat> images;
+    for (unsigned int seed = 42; seed < 46; seed++) {
+        auto field = smallField();
+        field.seed = seed;
+        images.push_back(generateBlobField(field));
+    }
+    auto od = rangeDetector();
+    std::vector<std::vector<cv::KeyPoint>> expected;
+    for (auto &image : images)
+        expected.push_back(od->detect(image));
+
+    // Every fifth image cannot be decoded.
+    DetectionPipeline pipeline(od);
+    pipeline.decodeWorkers(2);
+    pipeline.detectWorkers(3);
+    pipeline.sinkWorkers(2);
+    pipeline.queueCapacity(2);
+    std::mutex mutex;
+    std::vector<int> received(count, 0);
+    bool same = true;
+    pipeline.run(count, [&](size_t i, cv::Mat &image) {
+        image = images[i % images.size()];
+        return i % 5 != 4;
+    }, [&](size_t i, const std::vector<cv::KeyPoint> &keypoints) {
+        std::lock_guard<std::mutex> lock(mutex);
+        received[i]++;
+        same = same && sameKeypoints(expected[i % images.size()], keypoints);
+    });
+    bool passed = expect(same, "same keypoints");
+    for (size_t i = 0; i < count; i++)
+        passed = expect(received[i] == (i % 5 != 4 ? 1 : 0), "image " + std::to_string(i) + " received") && passed;
+    passed = expect(pipeline.statistics().failed == 2 && pipeline.statistics().detect.items == count - 2,
+                    "statistics") && passed;
+
+    bool rethrown = false;
+    try {
+        pipeline.run(count, [&](size_t i, cv::Mat &image) {
+            if (i == 3)
+                throw std::runtime_error("decoder");
+            image = images[i % images.size()];
+            return true;
+        }, [](size_t, const std::vector<cv::KeyPoint> &) {});
+    } catch (const std::runtime_error &) {
+        rethrown = true;
+    }
+    return expect(rethrown, "exception passed on") && passed;
+}
+
+/* ---------------------------------------------------------------------------------------------- */
+/* testMappedFrames() - memory-mapped frames of a raw file and of a PGM/PPM file hold the data    */
+/* that was written, a truncated image at the end is left out, and the RGB frames of a PPM file   */
+/* are converted to grayscale with the channel order of the file, while frame() refuses them. The */
+/* files are written to the working directory and removed afterwards.                             */
+/* ---------------------------------------------------------------------------------------------- */
+bool testMappedFrames() {
+    BlobField field = smallField();
+    field.width = 64;
+    field.height = 48;
+    field.blobs = 4;
+    std::vector<cv::Mat> images;
+    for (unsigned int seed = 42; seed < 45; seed++) {
+        field.seed = seed;
+        images.push_back(generateBlobField(field));
+    }
+    // The color image has other values in each channel, in RGB order.
+    cv::Mat rgb(field.height, field.width, CV_8UC3), gray;
+    for (int y = 0; y < rgb.rows; y++) {
+        auto p = rgb.ptr<uchar>(y);
+        for (int x = 0; x < rgb.cols; x++) {
+            p[3 * x] = images[0].at<uchar>(y, x);
+            p[3 * x + 1] = (uchar)(x * 4);
+            p[3 * x + 2] = (uchar)(y * 5);
+        }
+    }
+    cvtColor(rgb, gray, cv::COLOR_RGB2GRAY);
+
+    {
+        std::ofstream raw("tests_frames.y8", std::ios::binary), pnm("tests_frames.pnm", std::ios::binary);
+        raw << "HEADER";
+        for (auto &image : images)
+            raw.write((const char *)image.data, (std::streamsize)image.total());
+        raw.write((const char *)images[0].data, 10);
+        pnm << "P5\n# comment\n" << field.width << " " << field.height << "\n255\n";
+        pnm.write((const char *)images[1].data, (std::streamsize)images[1].total());
+        pnm << "P6 " << field.width << " " << field.height << " 255\n";
+        pnm.write((const char *)rgb.data, (std::streamsize)(rgb.total() * 3));
+        pnm << "P5 " << field.width << " " << field.height << " 255\n";
+        pnm.write((const char *)images[2].data, 10);
+    }
+
+    MappedFrames mapped;
+    bool passed = expect(mapped.openRaw("tests_frames.y8", images[0].size(), CV_8UC1, 6) && mapped.count() == 3,
+                         "raw frames opened");
+    for (size_t i = 0; i < mapped.count(); i++)
+        passed = expect(cv::norm(mapped.frame(i), images[i], cv::NORM_INF) == 0, "raw frame " + std::to_string(i))
+                 && passed;
+    passed = expect(mapped.openPnm("tests_frames.pnm") && mapped.count() == 2 && mapped.rgb(), "PNM frames opened")
+             && passed;
+    if (mapped.count() == 2) {
+        cv::Mat converted;
+        passed = expect(cv::norm(mapped.frame(0), images[1], cv::NORM_INF) == 0, "PGM frame") && passed;
+        passed = expect(cv::norm(mapped.grayFrame(1, converted), gray, cv::NORM_INF) == 0, "PPM frame") && passed;
+        passed = expect(mapped.frame(1).empty(), "PPM frame refused by frame()") && passed;
+    }
+    mapped.close();
+    std::remove("tests_frames.y8");
+    std::remove("tests_frames.pnm");
+    return passed;
+}
+
+/* ---------------------------------------------------------------------------------------------- */
+/* The tests, by name.                                                                            */
+/* ---------------------------------------------------------------------------------------------- */
+struct Test
+{
+    const char *name;
+    bool (*run)();
+};
+
+const std::vector<Test> tests = {
+        {"blobfield", testBlobField},
+        {"workers", testWorkers},
+        {"componenttree", testComponentTree},
+        {"grouping", testGrouping},
+        {"imagebuffers", testImageBuffers},
+        {"contexts", testContexts},
+        {"contourfeatures", testContourFeatures},
+        {"filterorder", testAdaptiveFilterOrder},
+        {"trace", testTrace},
+        {"parameters", testParameters},
+        {"tiles", testTiles},
+        {"pyramid", testPyramid},
+        {"stream", testStream},
+        {"static", testStaticDetector},
+        {"batchfilters", testBatchFilters},
+        {"components", testConnectedComponents},
+        {"levelcounts", testLevelCounts},
+        {"adaptive", testAdaptiveThreshold},
+        {"color", testColor},
+        {"runlength", testRunLength},
+        {"allocations", testAllocations},
+        {"radius", testRadius},
+        {"result", testDetectionResult},
+        {"pipeline", testPipeline},
+        {"mapped", testMappedFrames}};
+
+/* ---------------------------------------------------------------------------------------------- */
+/* main()                                                                                         */
+/* ---------------------------------------------------------------------------------------------- */
+int main(int argc, char **argv) {
+    std::string which = argc > 1 ? argv[1] : "";
+    auto known = [&]() {
+        for (auto &test : tests)
+            if (which == test.name)
+                return true;
+        return false;
+    };
+    if (argc > 2 || (argc > 1 && !known())) {
+        std::cout << "Usage: ObjectDetectorTests [test]; tests:";
+        for (auto &test : tests)
+            std::cout << " " << test.name;
+        std::cout << std::endl;
+        exit(EXIT_FAILURE);
+    }
+
+    bool passed = true;
+    for (auto &test : tests)
+        if (which.empty() || which == test.name) {
+            bool result = test.run();
+            std::cout << (result ? "PASS " : "FAIL ") << test.name << std::endl;
+            passed = passed && result;
+        }
+    return passed ? EXIT_SUCCESS : EXIT_FAILURE;
+}